@@ -0,0 +1,49 @@
+#include <string.h>
+
+#include "anim.h"
+
+ANIM *anim_add(ANIM_SCHEDULER *sched, ANIM_STEP step, uint32_t start, uint32_t duration)
+{
+	// When full the oldest goes, it is the closest to being done anyway.
+	if (sched->count == MAX_ANIMS) {
+		memmove(sched->anims, sched->anims + 1, (MAX_ANIMS - 1) * sizeof(ANIM));
+		sched->count--;
+	}
+	ANIM *anim = &sched->anims[sched->count++];
+	memset(anim, 0, sizeof(*anim));
+	anim->step = step;
+	anim->start = start;
+	anim->duration = duration ? duration : 1;
+	return anim;
+}
+
+void anim_run(ANIM_SCHEDULER *sched, uint32_t now, void *ctx)
+{
+	// Draw every animation at its current progress and drop finished ones.
+	// Nothing waits here, a slow frame just skips ahead.
+	int kept = 0;
+	for (int i = 0; i < sched->count; i++) {
+		ANIM *anim = &sched->anims[i];
+		int32_t elapsed = (int32_t)(now - anim->start);
+		if (elapsed >= (int32_t)anim->duration)
+			continue;
+
+		// Not started yet, keep it for later.
+		if (elapsed >= 0)
+			anim->step(ctx, anim, (int)((int64_t)elapsed * ANIM_SCALE / anim->duration));
+		if (kept != i)
+			sched->anims[kept] = *anim;
+		kept++;
+	}
+	sched->count = kept;
+}
+
+void anim_clear(ANIM_SCHEDULER *sched)
+{
+	sched->count = 0;
+}
+
+bool anim_active(const ANIM_SCHEDULER *sched)
+{
+	return sched->count > 0;
+}
@@ -0,0 +1,51 @@
+#ifndef ANIM_H
+#define ANIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "engine.h"
+
+// SCHEDULER SETTINGS
+#define MAX_ANIMS 16
+// Progress handed to a step runs from 0 up to, but not including, this.
+#define ANIM_SCALE 256
+
+// STRUCTURE AND DATA DEFINITIONS
+typedef struct ANIM ANIM;
+
+// Draws one frame of an animation. Must not block or present.
+typedef void (*ANIM_STEP)(void *ctx, const ANIM *anim, int progress);
+
+// A time based task, advanced a little every frame until it runs out.
+struct ANIM {
+	ANIM_STEP step;
+	uint32_t start;
+	uint32_t duration;
+	union {
+		// Rows removed by a clear, bit n is row n, and what was in them
+		struct {
+			uint64_t mask;
+			char rows[TETROMINO_WIDTH][MAX_WIDTH];
+		} clear;
+		// Board cells of the piece that just locked
+		struct {
+			int16_t cells[TETROMINO_WIDTH];
+		} lock;
+		// The level just reached
+		uint8_t level;
+	};
+};
+
+// Animations in the order they were added, which is also draw order.
+typedef struct ANIM_SCHEDULER {
+	ANIM anims[MAX_ANIMS];
+	int count;
+} ANIM_SCHEDULER;
+
+ANIM *anim_add(ANIM_SCHEDULER *sched, ANIM_STEP step, uint32_t start, uint32_t duration);
+void anim_run(ANIM_SCHEDULER *sched, uint32_t now, void *ctx);
+void anim_clear(ANIM_SCHEDULER *sched);
+bool anim_active(const ANIM_SCHEDULER *sched);
+
+#endif
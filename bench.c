@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "engine.h"
+#include "replay.h"
+
+// BENCHMARK SETTINGS
+#define DEFAULT_SECONDS 2
+#define MAX_REPLAYS 256
+
+// CORPUS SETTINGS
+// Games are recorded on a mix of sizes so every board kernel is trained.
+#define RECORD_INPUTS 2500
+// Game time between two recorded inputs
+#define RECORD_INPUT_MS 60
+static const int record_sizes[][2] = {
+	{ 10, 20 }, { 10, 20 }, { 10, 20 }, { 10, 40 },
+	{ 10, 40 }, { 4, 20 }, { 7, 13 }, { 16, 40 },
+};
+#define RECORD_GAMES ((int)(sizeof(record_sizes) / sizeof(record_sizes[0])))
+
+// TIMING FUNCTIONS
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// PLACEMENT SEARCH
+static int evaluate(const TETRIS_GAME *game, int events)
+{
+	// Lower and flatter is better, holes are worst.
+	int score = 0, previous = -1;
+	for (int col = 0; col < game->width; col++) {
+		int height = 0;
+		for (int row = 0; row < game->height; row++) {
+			bool filled = game->board[row * game->width + col] != '.';
+			if (filled && !height)
+				height = game->height - row;
+			else if (!filled && height)
+				score -= 36;
+		}
+		score -= height * 5;
+		if (previous >= 0)
+			score -= abs(height - previous) * 2;
+		previous = height;
+	}
+	if (events & EVENT_CLEAR)
+		score += 40 * (int)__builtin_popcountll(game->clear_mask);
+	return score;
+}
+
+static int search(const TETRIS_GAME *game, int *best_rotate, int *best_shift)
+{
+	// Every rotation and column the way a bot or hint would try them.
+	// Returns the number of placements tried.
+	int best = INT32_MIN, tried = 0;
+	*best_rotate = 0;
+	*best_shift = 0;
+	for (int rotate = 0; rotate < ROTATIONS; rotate++) {
+		for (int shift = -game->width / 2 - 1; shift <= game->width / 2 + 1; shift++) {
+			TETRIS_GAME trial = *game;
+			for (int i = 0; i < rotate; i++)
+				replay_apply(&trial, REPLAY_ROTATE);
+			for (int i = 0; i < abs(shift); i++)
+				replay_apply(&trial, shift < 0 ? REPLAY_LEFT : REPLAY_RIGHT);
+			int events = replay_apply(&trial, REPLAY_DROP);
+			tried++;
+			if (!(events & EVENT_PLACE))
+				continue;
+			int score = evaluate(&trial, events);
+			if (score > best) {
+				best = score;
+				*best_rotate = rotate;
+				*best_shift = shift;
+			}
+		}
+	}
+	return tried;
+}
+
+// BENCHMARKS
+// Both return the work done and fold the results into a checksum, which
+// has to come out the same for every build of the same corpus.
+static long bench_replay(REPLAY *replays, int count, uint32_t *checksum)
+{
+	// Plain playback, the engine calls a game or the server makes.
+	long inputs = 0;
+	for (int r = 0; r < count; r++) {
+		TETRIS_GAME game;
+		replay_start(&replays[r], &game);
+		for (uint32_t i = 0; i < replays[r].header.count; i++)
+			*checksum = *checksum * 31 + replay_apply(&game, replays[r].inputs[i].op);
+		*checksum = *checksum * 31 + game.score;
+		inputs += replays[r].header.count;
+	}
+	return inputs;
+}
+
+static long bench_search(REPLAY *replays, int count, uint32_t *checksum)
+{
+	// A full placement search for every piece of every game.
+	long tried = 0;
+	for (int r = 0; r < count; r++) {
+		TETRIS_GAME game;
+		replay_start(&replays[r], &game);
+		bool spawned = true;
+		for (uint32_t i = 0; i < replays[r].header.count; i++) {
+			if (spawned) {
+				int rotate, shift;
+				tried += search(&game, &rotate, &shift);
+				*checksum = *checksum * 31 + rotate * 64 + shift;
+			}
+			int events = replay_apply(&game, replays[r].inputs[i].op);
+			spawned = events & (EVENT_PLACE | EVENT_NEW_BAG);
+		}
+	}
+	return tried;
+}
+
+static double run(long (*bench)(REPLAY *, int, uint32_t *), REPLAY *replays, int count,
+		  double seconds, uint32_t *checksum)
+{
+	// Whole passes over the corpus until the time is up, in work per second.
+	long work = 0;
+	double start = now_seconds(), elapsed;
+	do {
+		*checksum = 0;
+		work += bench(replays, count, checksum);
+		elapsed = now_seconds() - start;
+	} while (elapsed < seconds);
+	return work / elapsed;
+}
+
+// CORPUS RECORDING
+static uint32_t next_random(uint32_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+	return *x;
+}
+
+static bool record_game(const char *dir, int n, uint32_t seed)
+{
+	// A bot game with gravity on the clock, the odd placement picked at
+	// random so games do end and restart.
+	int width = record_sizes[n][0], height = record_sizes[n][1];
+	TETRIS_GAME game;
+	REPLAY replay;
+	tetris_game_new(&game, width, height, seed);
+	replay_init(&replay, seed, width, height);
+	uint32_t x = seed * 2654435761u + 1;
+	uint8_t pending[ROTATIONS + MAX_WIDTH + 2];
+	int npending = 0;
+	uint32_t time = 0, last_step = 0;
+	for (int i = 0; i < RECORD_INPUTS; i++) {
+		time += RECORD_INPUT_MS;
+		REPLAY_OP op;
+		if (time - last_step >= (uint32_t)tetris_move_delay(&game)) {
+			op = REPLAY_STEP;
+			last_step = time;
+		} else {
+			if (npending == 0) {
+				int rotate, shift;
+				search(&game, &rotate, &shift);
+				if (next_random(&x) % 10 == 0) {
+					rotate = next_random(&x) % ROTATIONS;
+					shift = (int)(next_random(&x) % width) - width / 2;
+				}
+				pending[npending++] = REPLAY_DROP;
+				for (int s = 0; s < abs(shift); s++)
+					pending[npending++] = shift < 0 ? REPLAY_LEFT : REPLAY_RIGHT;
+				for (int s = 0; s < rotate; s++)
+					pending[npending++] = REPLAY_ROTATE;
+			}
+			op = pending[--npending];
+		}
+		replay_record(&replay, time, op);
+		int events = replay_apply(&game, op);
+		if (events & EVENT_PLACE)
+			npending = 0;
+		if (events & EVENT_GAME_OVER) {
+			time += RECORD_INPUT_MS;
+			replay_record(&replay, time, REPLAY_RESET);
+			replay_apply(&game, REPLAY_RESET);
+			npending = 0;
+			i++;
+		}
+	}
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%02d-%dx%d.rpl", dir, n, width, height);
+	bool saved = replay_save(path, &replay);
+	if (saved)
+		printf("%s: %u inputs\n", path, replay.header.count);
+	else
+		fprintf(stderr, "Unable to write %s\n", path);
+	replay_free(&replay);
+	return saved;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [--seconds N] [--label NAME] REPLAY...\n"
+		"       %s --record DIR [--seed N]\n"
+		"Replays the corpus headlessly at full speed, then runs a placement\n"
+		"search for every piece in it, and reports both rates.\n", name, name);
+}
+
+int main(int argc, char *argv[])
+{
+	double seconds = DEFAULT_SECONDS;
+	const char *label = NULL;
+	const char *record = NULL;
+	uint32_t seed = 1;
+	static REPLAY replays[MAX_REPLAYS];
+	int count = 0;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+			seconds = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--label") && i + 1 < argc) {
+			label = argv[++i];
+		} else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+			record = argv[++i];
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			seed = strtoul(argv[++i], NULL, 10);
+		} else if (argv[i][0] != '-' && count < MAX_REPLAYS) {
+			if (!replay_load(argv[i], &replays[count])) {
+				fprintf(stderr, "Unable to read replay %s\n", argv[i]);
+				return 1;
+			}
+			count++;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (record) {
+		for (int n = 0; n < RECORD_GAMES; n++)
+			if (!record_game(record, n, seed + n))
+				return 1;
+		return 0;
+	}
+	if (count == 0 || seconds <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Half the time each, after a pass to warm the caches.
+	uint32_t replay_sum = 0, search_sum = 0;
+	bench_replay(replays, count, &replay_sum);
+	double replay_rate = run(bench_replay, replays, count, seconds / 2, &replay_sum);
+	double search_rate = run(bench_search, replays, count, seconds / 2, &search_sum);
+	printf("%-10s %8.2f M inputs/s %8.1f K placements/s  checksum %08x\n",
+	       label ? label : "bench", replay_rate / 1e6, search_rate / 1e3,
+	       replay_sum ^ search_sum);
+	for (int r = 0; r < count; r++)
+		replay_free(&replays[r]);
+	return 0;
+}
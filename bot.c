@@ -0,0 +1,123 @@
+#include <stdlib.h>
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+#include "bot.h"
+#include "replay.h"
+
+// STATIC RESOURCES
+// The hand tuned stacker the wall started with, see tune.c for better ones.
+const BOT_WEIGHTS bot_default_weights = { {
+	[BOT_HEIGHT] = -5,
+	[BOT_HOLES] = -36,
+	[BOT_BUMPINESS] = -2,
+	[BOT_WELLS] = 0,
+	[BOT_LINES] = 40,
+} };
+
+const char *bot_feature_names[NUM_BOT_FEATURES] = {
+	[BOT_HEIGHT] = "height",
+	[BOT_HOLES] = "holes",
+	[BOT_BUMPINESS] = "bumpiness",
+	[BOT_WELLS] = "wells",
+	[BOT_LINES] = "lines",
+};
+
+// EVALUATION FUNCTIONS
+static uint32_t row_cells(const TETRIS_GAME *game, int row)
+{
+	// Bit n is set for a filled cell in column n.
+	const char *cells = game->board + row * game->width;
+#ifdef __wasm_simd128__
+	// A whole row in one compare. Rows are at most MAX_WIDTH cells and the
+	// board is sized for the largest, so the load never leaves it.
+	v128_t filled = wasm_i8x16_ne(wasm_v128_load(cells), wasm_i8x16_splat('.'));
+	return (uint32_t)wasm_i8x16_bitmask(filled) & ((1u << game->width) - 1);
+#else
+	uint32_t bits = 0;
+	for (int col = 0; col < game->width; col++)
+		if (cells[col] != '.')
+			bits |= 1u << col;
+	return bits;
+#endif
+}
+
+void bot_features(const TETRIS_GAME *game, int events, float features[NUM_BOT_FEATURES])
+{
+	// Top down a row at a time, covered holds the columns already reached.
+	int heights[MAX_WIDTH] = { 0 };
+	int holes = 0;
+	uint32_t covered = 0;
+	for (int row = 0; row < game->height; row++) {
+		uint32_t filled = row_cells(game, row);
+		holes += __builtin_popcount(covered & ~filled);
+		for (uint32_t top = filled & ~covered; top; top &= top - 1)
+			heights[__builtin_ctz(top)] = game->height - row;
+		covered |= filled;
+	}
+
+	int height = 0, bumpiness = 0, wells = 0;
+	for (int col = 0; col < game->width; col++) {
+		height += heights[col];
+		if (col)
+			bumpiness += abs(heights[col] - heights[col - 1]);
+		int left = col ? heights[col - 1] : game->height;
+		int right = col < game->width - 1 ? heights[col + 1] : game->height;
+		int depth = (left < right ? left : right) - heights[col];
+		if (depth > 0)
+			wells += depth;
+	}
+
+	features[BOT_HEIGHT] = height;
+	features[BOT_HOLES] = holes;
+	features[BOT_BUMPINESS] = bumpiness;
+	features[BOT_WELLS] = wells;
+	features[BOT_LINES] = events & EVENT_CLEAR ? __builtin_popcountll(game->clear_mask) : 0;
+}
+
+float bot_evaluate(const TETRIS_GAME *game, int events, const BOT_WEIGHTS *weights)
+{
+	float features[NUM_BOT_FEATURES];
+	bot_features(game, events, features);
+	float score = 0;
+	for (int i = 0; i < NUM_BOT_FEATURES; i++)
+		score += weights->w[i] * features[i];
+	return score;
+}
+
+// PLANNING FUNCTIONS
+int bot_plan(const TETRIS_GAME *game, const BOT_WEIGHTS *weights, uint8_t ops[BOT_MAX_OPS])
+{
+	float best = 0;
+	int best_rotate = 0, best_shift = 0;
+	bool found = false;
+	for (int rotate = 0; rotate < ROTATIONS; rotate++) {
+		for (int shift = -game->width / 2 - 1; shift <= game->width / 2 + 1; shift++) {
+			TETRIS_GAME trial = *game;
+			for (int i = 0; i < rotate; i++)
+				replay_apply(&trial, REPLAY_ROTATE);
+			for (int i = 0; i < abs(shift); i++)
+				replay_apply(&trial, shift < 0 ? REPLAY_LEFT : REPLAY_RIGHT);
+			int events = replay_apply(&trial, REPLAY_DROP);
+			if (!(events & EVENT_PLACE))
+				continue;
+			float score = bot_evaluate(&trial, events, weights);
+			if (!found || score > best) {
+				found = true;
+				best = score;
+				best_rotate = rotate;
+				best_shift = shift;
+			}
+		}
+	}
+
+	int n = 0;
+	for (int i = 0; i < best_rotate; i++)
+		ops[n++] = REPLAY_ROTATE;
+	for (int i = 0; i < abs(best_shift); i++)
+		ops[n++] = best_shift < 0 ? REPLAY_LEFT : REPLAY_RIGHT;
+	ops[n++] = REPLAY_DROP;
+	return n;
+}
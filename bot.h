@@ -0,0 +1,43 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "engine.h"
+
+// BOT SETTINGS
+// Inputs of one placement: rotations, shifts and the drop
+#define BOT_MAX_OPS (ROTATIONS + MAX_WIDTH + 2)
+
+// What a placement is judged on, per board after the drop.
+typedef enum BOT_FEATURE {
+	// Sum of the column heights
+	BOT_HEIGHT,
+	// Empty cells with something above them
+	BOT_HOLES,
+	// Height differences between neighbouring columns
+	BOT_BUMPINESS,
+	// Depth of columns lower than both neighbours, walls count as full
+	BOT_WELLS,
+	// Rows cleared by the placement
+	BOT_LINES,
+	NUM_BOT_FEATURES,
+} BOT_FEATURE;
+
+// A placement scores the weighted sum of its features. Only the direction
+// matters, so the tuner keeps them at unit length.
+typedef struct BOT_WEIGHTS {
+	float w[NUM_BOT_FEATURES];
+} BOT_WEIGHTS;
+
+extern const BOT_WEIGHTS bot_default_weights;
+extern const char *bot_feature_names[NUM_BOT_FEATURES];
+
+void bot_features(const TETRIS_GAME *game, int events, float features[NUM_BOT_FEATURES]);
+float bot_evaluate(const TETRIS_GAME *game, int events, const BOT_WEIGHTS *weights);
+// Tries every rotation and column and writes the inputs of the best one to
+// ops, in the order they are applied. Returns how many there are.
+int bot_plan(const TETRIS_GAME *game, const BOT_WEIGHTS *weights, uint8_t ops[BOT_MAX_OPS]);
+
+#endif
@@ -0,0 +1,722 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "engine.h"
+#include "replay.h"
+
+// DIFFTEST SETTINGS
+#define DEFAULT_SECONDS 10
+#define DEFAULT_STEPS 100000
+#define MAX_THREADS 256
+// Inputs are laid out this far apart in reproducers, so they export nicely.
+#define REPRO_INPUT_MS 50
+// Generated games are spread over these by seed: every size engine.c has
+// a kernel for, and some that take the generic path.
+static const int board_sizes[][2] = {
+	{ 10, 20 }, { 10, 20 }, { 10, 40 }, { 4, 20 }, { 7, 13 }, { 16, 40 },
+};
+#define NUM_BOARD_SIZES ((uint32_t)(sizeof(board_sizes) / sizeof(board_sizes[0])))
+
+// REFERENCE ENGINE
+// The rules as they were first written in tetris.c, kept as they were so
+// faster versions in engine.c always have something to be checked against.
+// Only the SDL calls are gone and rand() is the per game xorshift, since the
+// two sides have to deal the same bags, and the board size is a field like
+// in engine.c so every size can be checked. Do not optimize anything here.
+typedef struct REF_GAME {
+	uint32_t rng;
+	uint16_t score;
+	uint16_t rows_cleared;
+	uint8_t level;
+	uint8_t width;
+	uint8_t height;
+	// The original wrote parts of a piece still above the board before the
+	// board itself, into whatever was there. Here that is the rows of cells
+	// ahead of the board, which starts REF_ABOVE cells in, see ref_board.
+	char cells[MAX_WIDTH * TETROMINO_WIDTH + MAX_WIDTH * MAX_HEIGHT];
+	TETROMINO tetromino_bag[NUM_TETROMINO];
+	uint8_t bag_position;
+	TETROMINO tetromino_type;
+	int tetromino_x;
+	int tetromino_y;
+	ROTATION tetromino_rotation;
+} REF_GAME;
+
+#define REF_ABOVE (MAX_WIDTH * TETROMINO_WIDTH)
+
+static char *ref_board(REF_GAME *ref)
+{
+	return ref->cells + REF_ABOVE;
+}
+
+static uint32_t ref_random(REF_GAME *ref)
+{
+	uint32_t x = ref->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	ref->rng = x;
+	return x;
+}
+
+static int ref_translate_rotation(int x, int y, TETROMINO t, ROTATION rotation)
+{
+	// Disable O rotation.
+	if (t == O)
+		return y * TETROMINO_WIDTH + x;
+
+	switch (rotation % ROTATIONS) {
+	case DEG_0:
+		return y * TETROMINO_WIDTH + x;
+	case DEG_90:
+		return 12 + y - (x * TETROMINO_WIDTH);
+	case DEG_180:
+		return 15 - (y * TETROMINO_WIDTH) - x;
+	case DEG_270:
+		return 3 - y + (x * TETROMINO_WIDTH);
+	}
+	return y * TETROMINO_WIDTH + x;
+}
+
+static void ref_create_bag(REF_GAME *ref)
+{
+	static const TETROMINO start_bag[NUM_TETROMINO] = { I, O, T, S, Z, J, L };
+	memcpy(ref->tetromino_bag, start_bag, sizeof(TETROMINO) * NUM_TETROMINO);
+	for (size_t i = I; i < NUM_TETROMINO; i++) {
+		size_t j = i + ref_random(ref) % (NUM_TETROMINO - i);
+		TETROMINO t = ref->tetromino_bag[j];
+		ref->tetromino_bag[j] = ref->tetromino_bag[i];
+		ref->tetromino_bag[i] = t;
+	}
+	ref->bag_position = 0;
+}
+
+static int ref_has_space(REF_GAME *ref, ROTATION r, int x, int y)
+{
+	// Check next location.
+	// Returns 1 for out of bounds, 2 for block placement and 3 for game over.
+	for (int i = 0; i < TETROMINO_SIZE; i++) {
+		// Skip empty spaces
+		if (tetromino[ref->tetromino_type][i] == '.')
+			continue;
+
+		// Get rotation indexes if rotated
+		int rotatedIndex =
+			ref_translate_rotation(i % TETROMINO_WIDTH,
+					       i / TETROMINO_WIDTH,
+					       ref->tetromino_type, r);
+
+		// Add the indexes to the top left corner to get the actual position
+		int real_x = x + (rotatedIndex % TETROMINO_WIDTH);
+		int real_y = y + (rotatedIndex / TETROMINO_WIDTH);
+
+		// Check the x axis bounds
+		if (real_x < 0 || real_x >= ref->width)
+			return 1;
+
+		// Check if we have hit the bottom
+		if (real_y == ref->height)
+			return 2;
+
+		// Off the screen, cannot be a game over
+		if (real_y < 0)
+			continue;
+
+		// Check for game over or block placement
+		// Check space that we are moving to is empty
+		if (ref_board(ref)[real_x + (real_y * ref->width)] != '.') {
+			// Block on top.
+			if (real_y <= 0)
+				return 3;
+
+			return 2;
+		}
+	}
+	return 0;
+}
+
+static bool ref_move(REF_GAME *ref, ROTATION r, int x, int y)
+{
+	if (ref_has_space(ref, r, x, y) == 0) {
+		ref->tetromino_rotation = r;
+		ref->tetromino_x = x;
+		ref->tetromino_y = y;
+		return true;
+	}
+	// WALL KICKS
+	if (ref_has_space(ref, r, x + 1, y) == 0) {
+		ref->tetromino_rotation = r;
+		ref->tetromino_x = x + 1;
+		ref->tetromino_y = y;
+		return true;
+	}
+	if (ref_has_space(ref, r, x - 1, y) == 0) {
+		ref->tetromino_rotation = r;
+		ref->tetromino_x = x - 1;
+		ref->tetromino_y = y;
+		return true;
+	}
+	return false;
+}
+
+static void ref_init(REF_GAME *ref)
+{
+	ref->tetromino_type = ref->tetromino_bag[ref->bag_position];
+	ref->bag_position++;
+	if (ref->bag_position >= NUM_TETROMINO)
+		ref_create_bag(ref);
+
+	ref->tetromino_x = (ref->width / 2) - (TETROMINO_WIDTH / 2);
+	ref->tetromino_y = -TETROMINO_WIDTH;
+	ref->tetromino_rotation = DEG_0;
+	for (int i = 0; i < TETROMINO_WIDTH; i++) {
+		if (ref_has_space(ref, ref->tetromino_rotation,
+				  ref->tetromino_x,
+				  ref->tetromino_y + 1) != 0)
+			break;
+		ref->tetromino_y++;
+	}
+}
+
+static void ref_write(REF_GAME *ref)
+{
+	for (int i = 0; i < TETROMINO_SIZE; i++) {
+		if (tetromino[ref->tetromino_type][i] == '.')
+			continue;
+
+		int sub_x = i % TETROMINO_WIDTH;
+		int sub_y = i / TETROMINO_WIDTH;
+
+		int true_index =
+			ref_translate_rotation(sub_x, sub_y, ref->tetromino_type,
+					       ref->tetromino_rotation);
+
+		int true_x = true_index % TETROMINO_WIDTH;
+		int true_y = true_index / TETROMINO_WIDTH;
+
+		int index = ref->tetromino_x + true_x + ((ref->tetromino_y + true_y) * ref->width);
+
+		ref_board(ref)[index] = tetromino[ref->tetromino_type][i];
+	}
+}
+
+static int ref_drop_location(REF_GAME *ref)
+{
+	int y = ref->tetromino_y;
+	int space = -1;
+	while (true) {
+		space = ref_has_space(ref, ref->tetromino_rotation,
+				      ref->tetromino_x, y + 1);
+		if (space == 2 || space == 3)
+			return y;
+
+		y++;
+	}
+	return -1;
+}
+
+static void ref_clear_row(REF_GAME *ref)
+{
+	// Check all the rows
+	int cleared_rows[MAX_HEIGHT] = { 0 };
+	int cleared = 0;
+	for (int row = 0; row < ref->height; row++)
+		for (int col = 0; col < ref->width; col++) {
+			if (ref_board(ref)[(row * ref->width) + col] == '.')
+				break;
+			if (col == ref->width - 1) {
+				cleared_rows[row] = 1;
+				cleared++;
+			}
+		}
+
+	// No rows cleared.
+	if (!cleared)
+		return;
+
+	// Remove the rows
+	for (int row = 0; row < ref->height; row++) {
+		if (!cleared_rows[row])
+			continue;
+		memmove(ref_board(ref) + ref->width, ref_board(ref), row * ref->width);
+	}
+	// Initialize the top row
+	memset(ref_board(ref), '.', ref->width * cleared);
+
+	// Add the score!
+	switch (cleared) {
+	case 1:
+		ref->score += 40 * (ref->level + 1);
+		ref->rows_cleared += cleared;
+		break;
+	case 2:
+		ref->score += 100 * (ref->level + 1);
+		ref->rows_cleared += cleared;
+		break;
+	case 3:
+		ref->score += 300 * (ref->level + 1);
+		ref->rows_cleared += cleared;
+		break;
+	default:
+		ref->score += 1200 * (ref->level + 1);
+		ref->rows_cleared += cleared * 2;
+		break;
+	}
+	// New level?
+	int level;
+	if (ref->level < 10)
+		level = ref->rows_cleared / 10;
+	else if (ref->level < 20)
+		level = ref->rows_cleared / 15;
+	else if (ref->level < 30)
+		level = ref->rows_cleared / 20;
+	else
+		level = ref->rows_cleared / 25;
+
+	if (level > ref->level)
+		ref->level = level;
+}
+
+static void ref_reset(REF_GAME *ref, uint32_t seed)
+{
+	ref->rng = seed ? seed : 0x9E3779B9u;
+	memset(ref->cells, '.', sizeof(ref->cells));
+	ref->level = 0;
+	ref->rows_cleared = 0;
+	ref->score = 0;
+	ref_create_bag(ref);
+	ref_init(ref);
+	ref->tetromino_y = 0;
+}
+
+static void ref_new(REF_GAME *ref, int width, int height, uint32_t seed)
+{
+	ref->width = width;
+	ref->height = height;
+	ref_reset(ref, seed);
+}
+
+static bool ref_apply(REF_GAME *ref, REPLAY_OP op)
+{
+	// Same calls as the old update_state, fast_drop and handle_events.
+	// Returns true on a game over.
+	switch (op) {
+	case REPLAY_LEFT:
+		ref_move(ref, ref->tetromino_rotation, ref->tetromino_x - 1, ref->tetromino_y);
+		break;
+	case REPLAY_RIGHT:
+		ref_move(ref, ref->tetromino_rotation, ref->tetromino_x + 1, ref->tetromino_y);
+		break;
+	case REPLAY_ROTATE:
+		ref_move(ref, (ref->tetromino_rotation + 1) % ROTATIONS,
+			 ref->tetromino_x, ref->tetromino_y);
+		break;
+	case REPLAY_STEP: {
+		int move_status = ref_has_space(ref, ref->tetromino_rotation,
+						ref->tetromino_x, ref->tetromino_y + 1);
+		if (move_status == 2) {
+			ref_write(ref);
+			ref_clear_row(ref);
+			ref_init(ref);
+		} else if (move_status == 3) {
+			return true;
+		} else {
+			ref->tetromino_y++;
+		}
+		break;
+	}
+	case REPLAY_DROP: {
+		int drop_y = ref_drop_location(ref);
+		if (drop_y == -1)
+			break;
+		ref->tetromino_y = drop_y;
+		ref_write(ref);
+		ref_clear_row(ref);
+		ref_init(ref);
+		break;
+	}
+	case REPLAY_RESET:
+		ref_reset(ref, ref->rng);
+		break;
+	default:
+		break;
+	}
+	return false;
+}
+
+// COMPARISON
+static const char *compare(REF_GAME *ref, bool ref_over,
+			   const TETRIS_GAME *game, bool game_over)
+{
+	// Name of the first thing that differs, or NULL.
+	if (ref->width != game->width || ref->height != game->height ||
+	    memcmp(ref_board(ref), game->board, ref->width * ref->height))
+		return "board";
+	if (ref->score != game->score)
+		return "score";
+	if (ref->level != game->level)
+		return "level";
+	if (ref->rows_cleared != game->rows_cleared)
+		return "rows cleared";
+	if (ref_over != game_over)
+		return "game over";
+	if ((int)ref->tetromino_type != game->tetromino_type ||
+	    (int)ref->tetromino_rotation != game->tetromino_rotation ||
+	    ref->tetromino_x != game->tetromino_x || ref->tetromino_y != game->tetromino_y)
+		return "piece";
+	if (ref->bag_position != game->bag_position || ref->rng != game->rng)
+		return "bag";
+	for (int i = 0; i < NUM_TETROMINO; i++)
+		if ((int)ref->tetromino_bag[i] != game->tetromino_bag[i])
+			return "bag";
+	return NULL;
+}
+
+static long run(uint32_t seed, int width, int height, const uint8_t *ops, long count,
+		const char **what)
+{
+	// Feed the same inputs to both engines, returning the index of the first
+	// input after which they disagree or -1.
+	REF_GAME ref;
+	TETRIS_GAME game;
+	ref_new(&ref, width, height, seed);
+	tetris_game_new(&game, width, height, seed);
+	for (long i = 0; i < count; i++) {
+		bool ref_over = ref_apply(&ref, ops[i]);
+		bool game_over = replay_apply(&game, ops[i]) & EVENT_GAME_OVER;
+		const char *diff = compare(&ref, ref_over, &game, game_over);
+		if (diff) {
+			if (what)
+				*what = diff;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// INPUT GENERATION
+static uint32_t next_random(uint32_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+	return *x;
+}
+
+static int evaluate(const TETRIS_GAME *game, int events)
+{
+	// Crude stacking: low, flat and without holes, keeping the right column
+	// open as a well so several rows can go at once.
+	if (!(events & EVENT_PLACE))
+		return INT32_MIN + 1;
+	int score = 0, last = 0;
+	for (int col = 0; col < game->width; col++) {
+		int height = 0;
+		for (int row = 0; row < game->height; row++) {
+			bool filled = game->board[row * game->width + col] != '.';
+			if (filled && !height)
+				height = game->height - row;
+			else if (!filled && height)
+				score -= 36;
+		}
+		score -= height * (col == game->width - 1 ? 120 : 51);
+		if (col)
+			score -= abs(height - last) * 18;
+		last = height;
+	}
+	if (events & EVENT_CLEAR) {
+		int rows = __builtin_popcount(game->clear_mask);
+		score += 40 * rows * rows;
+	}
+	return score;
+}
+
+static int plan(const TETRIS_GAME *game, uint32_t r, uint8_t *pending)
+{
+	// Queue the inputs for one placement, backwards so they pop off the end.
+	// Usually the best by evaluate, sometimes random to keep some variety.
+	int best = INT32_MIN, best_rotate = 0, best_shift = 0;
+	for (int rotate = 0; rotate < ROTATIONS; rotate++) {
+		for (int shift = -game->width / 2 - 1; shift <= game->width / 2 + 1; shift++) {
+			TETRIS_GAME trial = *game;
+			for (int s = 0; s < rotate; s++)
+				replay_apply(&trial, REPLAY_ROTATE);
+			for (int s = 0; s < abs(shift); s++)
+				replay_apply(&trial, shift < 0 ? REPLAY_LEFT : REPLAY_RIGHT);
+			int score = evaluate(&trial, replay_apply(&trial, REPLAY_DROP));
+			if (r % 10 == 0)
+				score = (int)((r >> 8) % 1000 + rotate * 31 + shift * 17) % 1000;
+			if (score > best) {
+				best = score;
+				best_rotate = rotate;
+				best_shift = shift;
+			}
+		}
+	}
+	int n = 0;
+	pending[n++] = REPLAY_DROP;
+	for (int s = 0; s < abs(best_shift); s++)
+		pending[n++] = best_shift < 0 ? REPLAY_LEFT : REPLAY_RIGHT;
+	for (int s = 0; s < best_rotate; s++)
+		pending[n++] = REPLAY_ROTATE;
+	// Gravity first, which is also what ends a game that has topped out.
+	pending[n++] = REPLAY_STEP;
+	return n;
+}
+
+static void seed_board_size(uint32_t seed, int *width, int *height)
+{
+	// Not by the low bit, which picks the kind of play below.
+	*width = board_sizes[(seed >> 1) % NUM_BOARD_SIZES][0];
+	*height = board_sizes[(seed >> 1) % NUM_BOARD_SIZES][1];
+}
+
+static long generate(uint32_t seed, uint8_t *ops, long count, const char **what)
+{
+	// Random play, checked as it goes. The inputs depend on the game only
+	// through game overs, which are answered with a reset. Odd seeds play
+	// whole placements, rotate, shift and drop, which stacks flatter and
+	// reaches multi line clears that single random inputs almost never do.
+	uint32_t x = seed * 2654435761u + 1;
+	bool placements = seed & 1;
+	uint8_t pending[ROTATIONS + MAX_WIDTH + 2];
+	int npending = 0;
+	int width, height;
+	seed_board_size(seed, &width, &height);
+	REF_GAME ref;
+	TETRIS_GAME game;
+	ref_new(&ref, width, height, seed);
+	tetris_game_new(&game, width, height, seed);
+	bool over = false;
+	for (long i = 0; i < count; i++) {
+		uint8_t op;
+		uint32_t r = next_random(&x) % 100;
+		if (placements && !over && npending == 0)
+			npending = plan(&game, next_random(&x), pending);
+		if (over)
+			op = REPLAY_RESET;
+		else if (placements)
+			op = pending[--npending];
+		else if (r < 30)
+			op = REPLAY_STEP;
+		else if (r < 50)
+			op = REPLAY_LEFT;
+		else if (r < 70)
+			op = REPLAY_RIGHT;
+		else if (r < 92)
+			op = REPLAY_ROTATE;
+		else
+			op = REPLAY_DROP;
+		ops[i] = op;
+
+		bool ref_over = ref_apply(&ref, op);
+		bool game_over = replay_apply(&game, op) & EVENT_GAME_OVER;
+		*what = compare(&ref, ref_over, &game, game_over);
+		if (*what)
+			return i;
+		over = game_over;
+	}
+	return -1;
+}
+
+// MINIMIZATION
+static long minimize(uint32_t seed, int width, int height, uint8_t *ops, long count)
+{
+	// Delta debugging: drop chunks of inputs while the engines still
+	// disagree somewhere, halving the chunk size until single inputs.
+	uint8_t *trial = malloc(count);
+	if (!trial)
+		return count;
+	for (long chunk = count / 2; chunk >= 1; chunk /= 2) {
+		for (long start = 0; start < count;) {
+			long end = start + chunk < count ? start + chunk : count;
+			memcpy(trial, ops, start);
+			memcpy(trial + start, ops + end, count - end);
+			long n = count - (end - start);
+			long diverged = n ? run(seed, width, height, trial, n, NULL) : -1;
+			if (diverged >= 0) {
+				// Anything past the divergence is noise too.
+				count = diverged + 1;
+				memcpy(ops, trial, count);
+			} else {
+				start = end;
+			}
+		}
+	}
+	free(trial);
+	return count;
+}
+
+static void report(uint32_t seed, uint8_t *ops, long count)
+{
+	static const char *names[NUM_REPLAY_OPS] = {
+		"left", "right", "rotate", "step", "drop", "reset",
+	};
+	const char *what = NULL;
+	long original = count;
+	int width, height;
+	seed_board_size(seed, &width, &height);
+	count = minimize(seed, width, height, ops, count);
+	run(seed, width, height, ops, count, &what);
+	printf("Divergence in %s, seed %u on %dx%d, minimized from %ld to %ld inputs:\n",
+	       what ? what : "?", seed, width, height, original, count);
+	for (long i = 0; i < count; i++)
+		printf("%s%s", names[ops[i]], i + 1 < count ? " " : "\n");
+
+	// Reproducers are ordinary replays, so they also play in --export.
+	REPLAY replay;
+	replay_init(&replay, seed, width, height);
+	for (long i = 0; i < count; i++)
+		replay_record(&replay, (uint32_t)(i + 1) * REPRO_INPUT_MS, ops[i]);
+	char path[64];
+	snprintf(path, sizeof(path), "difftest-%u.rpl", seed);
+	if (replay_save(path, &replay))
+		printf("Reproducer written to %s\n", path);
+	replay_free(&replay);
+}
+
+// WORKERS
+typedef struct DIFFTEST {
+	uint32_t first_seed;
+	uint32_t seeds;
+	long steps;
+	double deadline;
+	atomic_uint next_seed;
+	atomic_uint played;
+	atomic_llong total_steps;
+	atomic_bool failed;
+	pthread_mutex_t report_lock;
+} DIFFTEST;
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_main(void *arg)
+{
+	DIFFTEST *test = arg;
+	uint8_t *ops = malloc(test->steps);
+	if (!ops)
+		return NULL;
+	while (!atomic_load(&test->failed)) {
+		uint32_t n = atomic_fetch_add(&test->next_seed, 1);
+		if (test->seeds ? n >= test->seeds : now_seconds() >= test->deadline)
+			break;
+
+		uint32_t seed = test->first_seed + n;
+		const char *what = NULL;
+		long diverged = generate(seed, ops, test->steps, &what);
+		atomic_fetch_add(&test->played, 1);
+		atomic_fetch_add(&test->total_steps,
+				 diverged < 0 ? test->steps : diverged + 1);
+		if (diverged < 0)
+			continue;
+
+		// Only the first divergence gets minimized and reported.
+		if (!atomic_exchange(&test->failed, true)) {
+			pthread_mutex_lock(&test->report_lock);
+			report(seed, ops, diverged + 1);
+			pthread_mutex_unlock(&test->report_lock);
+		}
+	}
+	free(ops);
+	return NULL;
+}
+
+static int check_replay(const char *path)
+{
+	REPLAY replay;
+	if (!replay_load(path, &replay)) {
+		fprintf(stderr, "Unable to read replay %s\n", path);
+		return 1;
+	}
+	uint8_t *ops = malloc(replay.header.count + 1);
+	if (!ops)
+		return 1;
+	for (uint32_t i = 0; i < replay.header.count; i++)
+		ops[i] = replay.inputs[i].op;
+	const char *what = NULL;
+	long diverged = run(replay.header.seed, replay.header.width, replay.header.height, ops,
+			    replay.header.count, &what);
+	if (diverged < 0)
+		printf("%s: engines agree over %u inputs\n", path, replay.header.count);
+	else
+		printf("%s: divergence in %s after input %ld\n", path, what, diverged);
+	free(ops);
+	replay_free(&replay);
+	return diverged < 0 ? 0 : 1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [--threads N] [--seconds N | --seeds N] [--steps N] [--seed N]\n"
+		"       %s --replay FILE\n"
+		"Plays seeded random inputs through the reference rules and engine.c\n"
+		"side by side and compares them after every input. On a divergence\n"
+		"the inputs are minimized and saved as a replay.\n", name, name);
+}
+
+int main(int argc, char *argv[])
+{
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long seconds = DEFAULT_SECONDS;
+	long steps = DEFAULT_STEPS;
+	long seeds = 0;
+	uint32_t first_seed = 1;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			threads = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+			seconds = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "--seeds") && i + 1 < argc) {
+			seeds = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "--steps") && i + 1 < argc) {
+			steps = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			first_seed = strtoul(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+			return check_replay(argv[++i]);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 1 || threads > MAX_THREADS || steps < 1 || seconds < 0 || seeds < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	DIFFTEST test = {
+		.first_seed = first_seed,
+		.seeds = seeds,
+		.steps = steps,
+		.report_lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	double start = now_seconds();
+	test.deadline = start + seconds;
+
+	pthread_t workers[MAX_THREADS];
+	for (long i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, worker_main, &test);
+	for (long i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+
+	double elapsed = now_seconds() - start;
+	long long total = atomic_load(&test.total_steps);
+	printf("%u seeds, %lld inputs in %.1f s on %ld threads (%.1f M inputs/min)%s\n",
+	       atomic_load(&test.played), total, elapsed, threads, total / elapsed * 60 / 1e6,
+	       atomic_load(&test.failed) ? "" : ", no divergence");
+	return atomic_load(&test.failed) ? 1 : 0;
+}
@@ -0,0 +1,419 @@
+#include <string.h>
+
+#include "engine.h"
+
+// STATIC RESOURCES
+const char *tetromino[NUM_TETROMINO] = {
+	"..I."
+	"..I."
+	"..I."
+	"..I.",
+	".OO."
+	".OO."
+	"...."
+	"....",
+	"..T."
+	".TTT"
+	"...."
+	"....",
+	"..SS"
+	".SS."
+	"...."
+	"....",
+	".ZZ."
+	"..ZZ"
+	"...."
+	"....",
+	".J.."
+	".JJJ"
+	"...."
+	"....",
+	"...L"
+	".LLL"
+	"...."
+	"....",
+};
+
+// HELPER FUNCTIONS
+uint32_t tetris_random(TETRIS_GAME *game)
+{
+	// xorshift32, small enough to live in every game and trivially saved.
+	uint32_t x = game->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	game->rng = x;
+	return x;
+}
+
+int tetris_move_delay(const TETRIS_GAME *game)
+{
+	return MOVE_DELAY - (int)(MOVE_DELAY * (DIFFICULTY_RATIO * game->level));
+}
+
+int tetromino_translate_rotation(int x, int y, TETROMINO t, ROTATION rotation)
+{
+	// Disable O rotation.
+	if (t == O)
+		return y * TETROMINO_WIDTH + x;
+
+	switch (rotation % ROTATIONS) {
+	case DEG_0:
+		return y * TETROMINO_WIDTH + x;
+	case DEG_90:
+		return 12 + y - (x * TETROMINO_WIDTH);
+	case DEG_180:
+		return 15 - (y * TETROMINO_WIDTH) - x;
+	case DEG_270:
+		return 3 - y + (x * TETROMINO_WIDTH);
+	}
+	return y * TETROMINO_WIDTH + x;
+}
+
+void tetromino_create_bag(TETRIS_GAME *game)
+{
+	static const uint8_t start_bag[NUM_TETROMINO] = { I, O, T, S, Z, J, L };
+	memcpy(game->tetromino_bag, start_bag, sizeof(start_bag));
+	for (size_t i = I; i < NUM_TETROMINO; i++) {
+		size_t j = i + tetris_random(game) % (NUM_TETROMINO - i);
+		uint8_t t = game->tetromino_bag[j];
+		game->tetromino_bag[j] = game->tetromino_bag[i];
+		game->tetromino_bag[i] = t;
+	}
+	game->bag_position = 0;
+}
+
+// BOARD KERNELS
+// Collision and line clear checks run on every move, so they are compiled
+// once per common board size with the dimensions as constants. Other sizes
+// use the same code with the dimensions read from the game.
+// Only sizes a build can hold get one.
+_Static_assert(MAX_WIDTH >= WIDTH && MAX_HEIGHT >= HEIGHT, "the standard board must fit");
+#if MAX_HEIGHT >= 40
+#define BOARD_KERNELS(X) X(10, 20) X(10, 40) X(4, 20)
+#else
+#define BOARD_KERNELS(X) X(10, 20) X(4, 20)
+#endif
+#define BOARD_SIZE(w, h) ((w) << 8 | (h))
+
+static inline int has_space(const TETRIS_GAME *game, ROTATION r, int x, int y,
+			    const int width, const int height)
+{
+	// Check next location.
+	// Returns 1 for out of bounds, 2 for block placement and 3 for game over.
+	for (int i = 0; i < TETROMINO_SIZE; i++) {
+		// Skip empty spaces
+		if (tetromino[game->tetromino_type][i] == '.')
+			continue;
+
+		// Get rotation indexes if rotated
+		int rotatedIndex =
+			tetromino_translate_rotation(i % TETROMINO_WIDTH,
+						     i / TETROMINO_WIDTH,
+						     game->tetromino_type, r);
+
+		// Add the indexes to the top left corner to get the actual position
+		int real_x = x + (rotatedIndex % TETROMINO_WIDTH);
+		int real_y = y + (rotatedIndex / TETROMINO_WIDTH);
+
+		// Check the x axis bounds
+		if (real_x < 0 || real_x >= width)
+			return 1;
+
+		// Check if we have hit the bottom
+		if (real_y == height)
+			return 2;
+
+		// Off the screen, cannot be a game over
+		if (real_y < 0)
+			continue;
+
+		// Check for game over or block placement
+		// Check space that we are moving to is empty
+		if (game->board[real_x + (real_y * width)] != '.') {
+			// Block on top.
+			if (real_y <= 0)
+				return 3;
+
+			return 2;
+		}
+	}
+	return 0;
+}
+
+static inline int clear_rows(TETRIS_GAME *game, const int width, const int height)
+{
+	// Check all the rows
+	int cleared_rows[MAX_HEIGHT] = { 0 };
+	int cleared = 0;
+	for (int row = 0; row < height; row++)
+		for (int col = 0; col < width; col++) {
+			if (game->board[(row * width) + col] == '.')
+				break;
+			if (col == width - 1) {
+				cleared_rows[row] = 1;
+				cleared++;
+			}
+		}
+
+	// No rows cleared.
+	if (!cleared)
+		return 0;
+
+	game->clear_mask = 0;
+	for (int row = 0; row < height; row++)
+		if (cleared_rows[row])
+			game->clear_mask |= (uint64_t)1 << row;
+
+	// Remove the rows
+	for (int row = 0; row < height; row++) {
+		if (!cleared_rows[row])
+			continue;
+		memmove(game->board + width, game->board, row * width);
+	}
+	// Initialize the top row
+	memset(game->board, '.', width * cleared);
+	return cleared;
+}
+
+#define DEFINE_KERNELS(w, h) \
+	static int has_space_##w##x##h(const TETRIS_GAME *game, ROTATION r, int x, int y) \
+	{ \
+		return has_space(game, r, x, y, w, h); \
+	} \
+	static int clear_rows_##w##x##h(TETRIS_GAME *game) \
+	{ \
+		return clear_rows(game, w, h); \
+	}
+BOARD_KERNELS(DEFINE_KERNELS)
+
+int tetromino_has_space(const TETRIS_GAME *game, ROTATION r, int x, int y)
+{
+#define HAS_SPACE_CASE(w, h) \
+	case BOARD_SIZE(w, h): \
+		return has_space_##w##x##h(game, r, x, y);
+	switch (BOARD_SIZE(game->width, game->height)) {
+		BOARD_KERNELS(HAS_SPACE_CASE)
+	}
+#undef HAS_SPACE_CASE
+	return has_space(game, r, x, y, game->width, game->height);
+}
+
+bool tetromino_move(TETRIS_GAME *game, ROTATION r, int x, int y)
+{
+	// Checks if new state is possible, writes if so otherwise does nothing.
+	// Checks and allows for wall kicks
+	// Check with original movement attempt.
+	if (tetromino_has_space(game, r, x, y) == 0) {
+		// Can move! write new position.
+		game->tetromino_rotation = r;
+		game->tetromino_x = x;
+		game->tetromino_y = y;
+		return true;
+	}
+	// WALL KICKS
+	// Check if there is a free space to the right.
+	if (tetromino_has_space(game, r, x + 1, y) == 0) {
+		game->tetromino_rotation = r;
+		game->tetromino_x = x + 1;
+		game->tetromino_y = y;
+		return true;
+	}
+	// Check if there is a free space to the left.
+	if (tetromino_has_space(game, r, x - 1, y) == 0) {
+		game->tetromino_rotation = r;
+		game->tetromino_x = x - 1;
+		game->tetromino_y = y;
+		return true;
+	}
+	// FLOOR KICKS // DO WE NEED IT?
+	return false;
+}
+
+void tetromino_init(TETRIS_GAME *game)
+{
+	game->tetromino_type = game->tetromino_bag[game->bag_position];
+	game->bag_position++;
+	if (game->bag_position >= NUM_TETROMINO)
+		tetromino_create_bag(game);
+
+	game->tetromino_x = (game->width / 2) - (TETROMINO_WIDTH / 2);
+	game->tetromino_y = -TETROMINO_WIDTH;
+	game->tetromino_rotation = DEG_0;
+	for (int i = 0; i < TETROMINO_WIDTH; i++) {
+		if (tetromino_has_space(game, game->tetromino_rotation,
+					game->tetromino_x,
+					game->tetromino_y + 1) != 0)
+			break;
+		game->tetromino_y++;
+	}
+}
+
+void tetromino_write(TETRIS_GAME *game)
+{
+	// Convert tetromino x and y to actual board coordinates
+	for (int i = 0; i < TETROMINO_SIZE; i++) {
+		if (tetromino[game->tetromino_type][i] == '.')
+			continue;
+
+		// Get the x and y inside of the tetromino
+		int sub_x = i % TETROMINO_WIDTH;
+		int sub_y = i / TETROMINO_WIDTH;
+
+		// Get the rotated index
+		int true_index =
+			tetromino_translate_rotation(sub_x, sub_y, game->tetromino_type,
+						     game->tetromino_rotation);
+
+		int true_x = true_index % TETROMINO_WIDTH;
+		int true_y = true_index / TETROMINO_WIDTH;
+
+		// Parts still above the board have nowhere to go.
+		if (game->tetromino_y + true_y < 0)
+			continue;
+
+		// Write to the board
+		// Index translation.
+		int index = game->tetromino_x + true_x + ((game->tetromino_y + true_y) * game->width);
+
+		game->board[index] = tetromino[game->tetromino_type][i];
+	}
+}
+
+int tetromino_drop_location(const TETRIS_GAME *game)
+{
+	int y = game->tetromino_y;
+	int space = -1;
+	while (true) {
+		space = tetromino_has_space(game, game->tetromino_rotation,
+					    game->tetromino_x, y + 1);
+		if (space == 2 || space == 3)
+			return y;
+
+		y++;
+	}
+	return -1;
+}
+
+int tetromino_clear_row(TETRIS_GAME *game)
+{
+	int cleared;
+#define CLEAR_ROWS_CASE(w, h) \
+	case BOARD_SIZE(w, h): \
+		cleared = clear_rows_##w##x##h(game); \
+		break;
+	switch (BOARD_SIZE(game->width, game->height)) {
+		BOARD_KERNELS(CLEAR_ROWS_CASE)
+	default:
+		cleared = clear_rows(game, game->width, game->height);
+		break;
+	}
+#undef CLEAR_ROWS_CASE
+
+	// No rows cleared.
+	if (!cleared)
+		return EVENT_NONE;
+
+	int events = EVENT_CLEAR;
+
+	// Add the score!
+	switch (cleared) {
+	case 1:
+		game->score += 40 * (game->level + 1);
+		game->rows_cleared += cleared;
+		break;
+	case 2:
+		game->score += 100 * (game->level + 1);
+		game->rows_cleared += cleared;
+		break;
+	case 3:
+		game->score += 300 * (game->level + 1);
+		game->rows_cleared += cleared;
+		break;
+	default:
+		game->score += 1200 * (game->level + 1);
+		game->rows_cleared += cleared * 2;
+		break;
+	}
+	// New level?
+	int level;
+	if (game->level < 10)
+		level = game->rows_cleared / 10;
+	else if (game->level < 20)
+		level = game->rows_cleared / 15;
+	else if (game->level < 30)
+		level = game->rows_cleared / 20;
+	else
+		level = game->rows_cleared / 25;
+
+	if (level > game->level) {
+		game->level = level;
+		events |= EVENT_LEVEL_UP;
+	}
+	return events;
+}
+
+// GAME ACTIONS
+static int tetris_game_place(TETRIS_GAME *game)
+{
+	int events = EVENT_PLACE;
+	tetromino_write(game);
+	events |= tetromino_clear_row(game);
+	tetromino_init(game);
+	if (game->bag_position == 0)
+		events |= EVENT_NEW_BAG;
+	return events;
+}
+
+bool tetris_board_size_valid(int width, int height)
+{
+	// Rows are tracked in a 64 bit clear mask and cells in int16 indexes.
+	return width >= MIN_WIDTH && width <= MAX_WIDTH &&
+	       height >= MIN_HEIGHT && height <= MAX_HEIGHT;
+}
+
+void tetris_game_new(TETRIS_GAME *game, int width, int height, uint32_t seed)
+{
+	// The size must pass tetris_board_size_valid.
+	memset(game, 0, sizeof(*game));
+	game->width = width;
+	game->height = height;
+	// xorshift has a fixed point at zero.
+	game->rng = seed ? seed : 0x9E3779B9u;
+	memset(game->board, '.', width * height);
+	tetromino_create_bag(game);
+	tetromino_init(game);
+	game->tetromino_y = 0;
+}
+
+void tetris_game_reset(TETRIS_GAME *game, uint32_t seed)
+{
+	// Next game on the same board.
+	tetris_game_new(game, game->width, game->height, seed);
+}
+
+int tetris_game_step(TETRIS_GAME *game)
+{
+	// Gravity: move the piece down one unit, placing it if it lands.
+	int move_status = tetromino_has_space(game, game->tetromino_rotation,
+					      game->tetromino_x, game->tetromino_y + 1);
+	if (move_status == 2)
+		return tetris_game_place(game);
+
+	if (move_status == 3)
+		return EVENT_GAME_OVER;
+
+	game->tetromino_y++;
+	return EVENT_MOVE;
+}
+
+int tetris_game_fast_drop(TETRIS_GAME *game)
+{
+	int drop_y = tetromino_drop_location(game);
+
+	if (drop_y == -1)
+		return EVENT_NONE;
+
+	game->tetromino_y = drop_y;
+	return tetris_game_place(game);
+}
@@ -0,0 +1,112 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// PLAY GRID DIMENSIONS
+// The standard board. Any size within the limits below can be picked per
+// game with tetris_game_new.
+#define WIDTH 10
+#define HEIGHT 20
+#define MIN_WIDTH 4
+#define MIN_HEIGHT 4
+// Every game's board is sized for the largest, so a build that only plays
+// the standard board (the server) defines these to it to keep games small.
+#ifndef MAX_WIDTH
+#define MAX_WIDTH 16
+#endif
+#ifndef MAX_HEIGHT
+#define MAX_HEIGHT 40
+#endif
+
+// NUMBER OF CHARACTERS PER TETROMINO
+#define TETROMINO_WIDTH 4
+#define TETROMINO_SIZE 16
+
+// GAMEPLAY MODIFIERS
+#define MOVE_DELAY 1000
+#define MIN_MOVE_DELAY 25
+#define ROTATION_DELAY 100
+#define DIFFICULTY_RATIO 0.1
+
+// STRUCTURE AND DATA DEFINITIONS
+typedef enum TETROMINO {
+	I,
+	O,
+	T,
+	S,
+	Z,
+	J,
+	L,
+	NUM_TETROMINO,
+} TETROMINO;
+
+typedef enum ROTATION {
+	DEG_0,
+	DEG_90,
+	DEG_180,
+	DEG_270,
+	ROTATIONS,
+} ROTATION;
+
+// Things that happened during a call into the engine, so the front end can
+// play sounds and redraw without the rules knowing about either.
+typedef enum TETRIS_EVENT {
+	EVENT_NONE = 0,
+	EVENT_MOVE = 1 << 0,
+	EVENT_PLACE = 1 << 1,
+	EVENT_CLEAR = 1 << 2,
+	EVENT_LEVEL_UP = 1 << 3,
+	EVENT_NEW_BAG = 1 << 4,
+	EVENT_GAME_OVER = 1 << 5,
+} TETRIS_EVENT;
+
+// Rules state of a single game. Kept free of pointers and platform types so
+// it can be copied, stored and stepped without SDL.
+typedef struct TETRIS_GAME {
+	// Per game random state, see tetris_random.
+	uint32_t rng;
+	// Score
+	uint16_t score;
+	uint16_t rows_cleared;
+	uint8_t level;
+	// Tetris Tetromino bag
+	uint8_t bag_position;
+	uint8_t tetromino_bag[NUM_TETROMINO];
+	// Current piece
+	uint8_t tetromino_type;
+	uint8_t tetromino_rotation;
+	int8_t tetromino_x;
+	int8_t tetromino_y;
+	// Board size in cells, fixed for the whole game
+	uint8_t width;
+	uint8_t height;
+	// Rows removed by the last clear, bit n is row n from the top.
+	uint64_t clear_mask;
+	// Board, width cells a row with the rows packed at the start
+	char board[MAX_WIDTH * MAX_HEIGHT];
+} TETRIS_GAME;
+
+extern const char *tetromino[NUM_TETROMINO];
+
+// RULES
+uint32_t tetris_random(TETRIS_GAME *game);
+int tetris_move_delay(const TETRIS_GAME *game);
+int tetromino_translate_rotation(int x, int y, TETROMINO t, ROTATION rotation);
+void tetromino_create_bag(TETRIS_GAME *game);
+int tetromino_has_space(const TETRIS_GAME *game, ROTATION r, int x, int y);
+bool tetromino_move(TETRIS_GAME *game, ROTATION r, int x, int y);
+void tetromino_init(TETRIS_GAME *game);
+void tetromino_write(TETRIS_GAME *game);
+int tetromino_drop_location(const TETRIS_GAME *game);
+int tetromino_clear_row(TETRIS_GAME *game);
+
+// GAME ACTIONS
+bool tetris_board_size_valid(int width, int height);
+void tetris_game_new(TETRIS_GAME *game, int width, int height, uint32_t seed);
+void tetris_game_reset(TETRIS_GAME *game, uint32_t seed);
+int tetris_game_step(TETRIS_GAME *game);
+int tetris_game_fast_drop(TETRIS_GAME *game);
+
+#endif
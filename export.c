@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "tetris.h"
+#include "engine.h"
+#include "replay.h"
+
+// EXPORT SETTINGS
+// Frames rendered ahead of the writer per worker, for Y4M output
+#define FRAMES_AHEAD 4
+// Hold the last frame this long so the ending is visible
+#define TAIL_MS 2000
+
+// STRUCTURE AND DATA DEFINITIONS
+typedef struct EXPORT_FRAME {
+	TETRIS_GAME game;
+	uint8_t status;
+	// Time shown in the UI, since the start of the current game
+	uint32_t time;
+} EXPORT_FRAME;
+
+typedef struct EXPORT_JOB {
+	EXPORT_FRAME *frames;
+	int count;
+	const char *out_path;
+	bool y4m;
+	// Video size, the window rounded down to even for 4:2:0
+	int width;
+	int height;
+	size_t frame_bytes;
+	// Next frame to hand out
+	SDL_atomic_t next;
+	// Y4M only: slots of converted frames waiting for the writer
+	uint8_t *slots;
+	bool *ready;
+	int nslots;
+	int written;
+	bool failed;
+	SDL_mutex *lock;
+	SDL_cond *cond;
+} EXPORT_JOB;
+
+typedef struct EXPORT_WORKER {
+	EXPORT_JOB *job;
+	SDL_Surface *surface;
+	TETRIS_STATE tetris;
+	SDL_Thread *thread;
+} EXPORT_WORKER;
+
+// SIMULATION
+static EXPORT_FRAME *simulate(const REPLAY *replay, int fps, int *count)
+{
+	// Sample the game at every frame time. This is cheap next to rendering,
+	// so it runs up front and lets frames render in any order.
+	uint32_t end = replay->header.count ?
+		       replay->inputs[replay->header.count - 1].time : 0;
+	end += TAIL_MS;
+	int n = (int)((uint64_t)end * fps / 1000) + 1;
+	EXPORT_FRAME *frames = malloc(n * sizeof(EXPORT_FRAME));
+	if (!frames)
+		return NULL;
+
+	TETRIS_GAME game;
+	replay_start(replay, &game);
+	uint8_t status = PLAYING;
+	uint32_t game_start = 0;
+	uint32_t input = 0;
+	for (int i = 0; i < n; i++) {
+		uint32_t t = (uint32_t)((uint64_t)i * 1000 / fps);
+		for (; input < replay->header.count && replay->inputs[input].time <= t;
+		     input++) {
+			const REPLAY_INPUT *in = &replay->inputs[input];
+			int events = replay_apply(&game, in->op);
+			if (in->op == REPLAY_RESET) {
+				status = PLAYING;
+				game_start = in->time;
+			} else if (events & EVENT_GAME_OVER) {
+				status = GAME_OVER;
+			}
+		}
+		frames[i] = (EXPORT_FRAME){
+			.game = game,
+			.status = status,
+			.time = t - game_start,
+		};
+	}
+	*count = n;
+	return frames;
+}
+
+// RENDERING
+static void render_frame(EXPORT_WORKER *worker, const EXPORT_FRAME *frame)
+{
+	TETRIS_STATE *tetris = &worker->tetris;
+	tetris->game = frame->game;
+	tetris->status = frame->status;
+	SDL_RenderClear(tetris->renderer);
+	draw_border(tetris);
+	draw_board(tetris);
+	draw_ui(tetris, frame->time);
+	draw_bag(tetris);
+	if (frame->status == GAME_OVER)
+		draw_game_over(tetris);
+	SDL_RenderPresent(tetris->renderer);
+}
+
+static void convert_yuv(const SDL_Surface *surface, uint8_t *out, int width, int height)
+{
+	// Full range BT.601, which is what the C420jpeg tag promises.
+	uint8_t *y_plane = out;
+	uint8_t *u_plane = out + width * height;
+	uint8_t *v_plane = u_plane + width * height / 4;
+	for (int y = 0; y < height; y += 2) {
+		const uint32_t *row[2] = {
+			(const uint32_t *)((const uint8_t *)surface->pixels + y * surface->pitch),
+			(const uint32_t *)((const uint8_t *)surface->pixels + (y + 1) * surface->pitch),
+		};
+		for (int x = 0; x < width; x += 2) {
+			int r = 0, g = 0, b = 0;
+			for (int dy = 0; dy < 2; dy++) {
+				for (int dx = 0; dx < 2; dx++) {
+					uint32_t p = row[dy][x + dx];
+					int pr = (p >> 16) & 0xFF;
+					int pg = (p >> 8) & 0xFF;
+					int pb = p & 0xFF;
+					y_plane[(y + dy) * width + x + dx] =
+						(uint8_t)((77 * pr + 150 * pg + 29 * pb + 128) >> 8);
+					r += pr;
+					g += pg;
+					b += pb;
+				}
+			}
+			int c = (y / 2) * (width / 2) + x / 2;
+			u_plane[c] = (uint8_t)(((-43 * r - 85 * g + 128 * b + 512) >> 10) + 128);
+			v_plane[c] = (uint8_t)(((128 * r - 107 * g - 21 * b + 512) >> 10) + 128);
+		}
+	}
+}
+
+static int export_worker(void *data)
+{
+	EXPORT_WORKER *worker = data;
+	EXPORT_JOB *job = worker->job;
+	for (;;) {
+		int i = SDL_AtomicAdd(&job->next, 1);
+		if (i >= job->count)
+			break;
+		render_frame(worker, &job->frames[i]);
+
+		if (!job->y4m) {
+			char path[FILENAME_MAX];
+			snprintf(path, sizeof(path), job->out_path, i);
+			if (IMG_SavePNG(worker->surface, path) != 0) {
+				SDL_LockMutex(job->lock);
+				job->failed = true;
+				SDL_UnlockMutex(job->lock);
+			}
+			continue;
+		}
+
+		// Wait for the writer to free this frame's slot.
+		int slot = i % job->nslots;
+		SDL_LockMutex(job->lock);
+		while (i >= job->written + job->nslots && !job->failed)
+			SDL_CondWait(job->cond, job->lock);
+		bool failed = job->failed;
+		SDL_UnlockMutex(job->lock);
+		if (failed)
+			break;
+
+		convert_yuv(worker->surface, job->slots + (size_t)slot * job->frame_bytes,
+			    job->width, job->height);
+		SDL_LockMutex(job->lock);
+		job->ready[slot] = true;
+		SDL_CondBroadcast(job->cond);
+		SDL_UnlockMutex(job->lock);
+	}
+	return 0;
+}
+
+static bool write_y4m(EXPORT_JOB *job, FILE *file, int fps)
+{
+	// Frames finish out of order, write them in order as they come in.
+	fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+		job->width, job->height, fps);
+	for (int i = 0; i < job->count; i++) {
+		int slot = i % job->nslots;
+		SDL_LockMutex(job->lock);
+		while (!job->ready[slot])
+			SDL_CondWait(job->cond, job->lock);
+		SDL_UnlockMutex(job->lock);
+
+		bool ok = fputs("FRAME\n", file) >= 0 &&
+			  fwrite(job->slots + (size_t)slot * job->frame_bytes, job->frame_bytes, 1,
+				 file) == 1;
+
+		SDL_LockMutex(job->lock);
+		job->ready[slot] = false;
+		job->written++;
+		job->failed = job->failed || !ok;
+		SDL_CondBroadcast(job->cond);
+		SDL_UnlockMutex(job->lock);
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+
+// EXPORT
+static bool has_suffix(const char *s, const char *suffix)
+{
+	size_t n = strlen(s), m = strlen(suffix);
+	return n >= m && !strcmp(s + n - m, suffix);
+}
+
+static bool frame_pattern_valid(const char *pattern)
+{
+	// The name of every PNG is printed from the pattern, so it must hold
+	// exactly one frame number, %d or %0Nd, and no other conversion.
+	int numbers = 0;
+	for (const char *p = pattern; *p; p++) {
+		if (*p != '%')
+			continue;
+		if (*++p == '%')
+			continue;
+		if (*p == '0') {
+			p++;
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
+		if (*p != 'd')
+			return false;
+		numbers++;
+	}
+	return numbers == 1;
+}
+
+int export_replay(const char *replay_path, const char *out_path, int threads,
+		  int fps)
+{
+	bool y4m = has_suffix(out_path, ".y4m");
+	if (!y4m && !frame_pattern_valid(out_path)) {
+		fprintf(stderr, "%s must end in .y4m or number the frames with one %%d or %%0Nd\n",
+			out_path);
+		return 1;
+	}
+
+	REPLAY replay;
+	if (!replay_load(replay_path, &replay)) {
+		fprintf(stderr, "Unable to read replay %s\n", replay_path);
+		return 1;
+	}
+	if (fps <= 0)
+		fps = 60;
+	if (threads <= 0)
+		threads = SDL_GetCPUCount();
+
+	EXPORT_JOB job = {
+		.out_path = out_path,
+		.y4m = y4m,
+		.nslots = threads * FRAMES_AHEAD,
+		.lock = SDL_CreateMutex(),
+		.cond = SDL_CreateCond(),
+	};
+	// Drawn at the size the game window had for this board.
+	TETRIS_LAYOUT layout;
+	render_layout(&layout, replay.header.width, replay.header.height);
+	job.width = layout.window_width & ~1;
+	job.height = layout.window_height & ~1;
+	job.frame_bytes = (size_t)job.width * job.height * 3 / 2;
+	job.frames = simulate(&replay, fps, &job.count);
+	replay_free(&replay);
+
+	FILE *file = NULL;
+	int started = 0;
+	bool ok = false;
+	if (job.y4m) {
+		job.slots = malloc((size_t)job.nslots * job.frame_bytes);
+		job.ready = calloc(job.nslots, sizeof(bool));
+		file = fopen(out_path, "wb");
+	}
+	EXPORT_WORKER *workers = calloc(threads, sizeof(EXPORT_WORKER));
+	if (!job.frames || !workers || (job.y4m && (!job.slots || !job.ready || !file))) {
+		fprintf(stderr, "Unable to start export to %s\n", out_path);
+		goto out;
+	}
+
+	// Each worker draws into its own surface with the software renderer.
+	// Assets are loaded here since fonts can't be opened in parallel.
+	for (int i = 0; i < threads; i++) {
+		EXPORT_WORKER *worker = &workers[i];
+		worker->job = &job;
+		worker->surface = SDL_CreateRGBSurfaceWithFormat(0, layout.window_width,
+								 layout.window_height,
+								 32, SDL_PIXELFORMAT_ARGB8888);
+		if (!worker->surface)
+			break;
+		TETRIS_STATE *tetris = &worker->tetris;
+		tetris->layout = layout;
+		tetris->renderer = SDL_CreateSoftwareRenderer(worker->surface);
+		if (!tetris->renderer)
+			break;
+		SDL_SetRenderDrawColor(tetris->renderer, 0, 0, 0, 255);
+		SDL_SetRenderDrawBlendMode(tetris->renderer, SDL_BLENDMODE_BLEND);
+		render_load_assets(tetris);
+		started++;
+	}
+	if (started == 0) {
+		fprintf(stderr, "Unable to create renderer: %s\n", SDL_GetError());
+		goto out;
+	}
+	// Fewer workers only means fewer slots in use at once.
+	int running = 0;
+	for (int i = 0; i < started; i++) {
+		workers[i].thread = SDL_CreateThread(export_worker, "export", &workers[i]);
+		running += workers[i].thread != NULL;
+	}
+	if (running == 0) {
+		fprintf(stderr, "Unable to start export threads: %s\n", SDL_GetError());
+		goto out;
+	}
+
+	ok = !job.y4m || write_y4m(&job, file, fps);
+	for (int i = 0; i < started; i++)
+		SDL_WaitThread(workers[i].thread, NULL);
+	ok = ok && !job.failed;
+	if (!ok)
+		fprintf(stderr, "Failed writing %s\n", out_path);
+	else
+		printf("Exported %d frames to %s\n", job.count, out_path);
+
+out:
+	for (int i = 0; i < threads && workers; i++) {
+		if (workers[i].tetris.renderer) {
+			render_free_assets(&workers[i].tetris);
+			SDL_DestroyRenderer(workers[i].tetris.renderer);
+		}
+		if (workers[i].surface)
+			SDL_FreeSurface(workers[i].surface);
+	}
+	if (file && fclose(file) != 0)
+		ok = false;
+	free(workers);
+	free(job.slots);
+	free(job.ready);
+	free(job.frames);
+	SDL_DestroyCond(job.cond);
+	SDL_DestroyMutex(job.lock);
+	return ok ? 0 : 1;
+}
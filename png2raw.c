@@ -0,0 +1,49 @@
+#include <stdio.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+// Build tool: turns a PNG into a header of raw RGBA32 pixels, laid out like
+// xxd -i output, so the game can upload textures at startup without
+// decoding anything.
+int main(int argc, char *argv[])
+{
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s IN.png OUT.h NAME\n", argv[0]);
+		return 1;
+	}
+	SDL_Surface *image = IMG_Load(argv[1]);
+	if (!image) {
+		fprintf(stderr, "%s: %s\n", argv[1], IMG_GetError());
+		return 1;
+	}
+	// RGBA32 is R, G, B, A in memory on any machine, which is what GL and
+	// most drivers want for a static texture.
+	SDL_Surface *rgba = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_RGBA32, 0);
+	SDL_FreeSurface(image);
+	if (!rgba) {
+		fprintf(stderr, "%s: %s\n", argv[1], SDL_GetError());
+		return 1;
+	}
+
+	FILE *out = fopen(argv[2], "w");
+	if (!out) {
+		perror(argv[2]);
+		return 1;
+	}
+	fprintf(out, "// Generated from %s by png2raw, do not edit.\n", argv[1]);
+	fprintf(out, "unsigned int %s_width = %d;\n", argv[3], rgba->w);
+	fprintf(out, "unsigned int %s_height = %d;\n", argv[3], rgba->h);
+	fprintf(out, "unsigned char %s[] = {", argv[3]);
+	// Rows are written tightly packed, whatever the surface pitch.
+	const int row_bytes = rgba->w * 4;
+	long n = 0;
+	for (int y = 0; y < rgba->h; y++) {
+		const unsigned char *row = (const unsigned char *)rgba->pixels + y * rgba->pitch;
+		for (int x = 0; x < row_bytes; x++, n++)
+			fprintf(out, "%s0x%02x", n % 12 ? ", " : (n ? ",\n  " : "\n  "), row[x]);
+	}
+	fprintf(out, "\n};\nunsigned int %s_len = %ld;\n", argv[3], n);
+	SDL_FreeSurface(rgba);
+	return fclose(out) == 0 ? 0 : 1;
+}
@@ -0,0 +1,291 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "posdb.h"
+#include "replay.h"
+
+// Sections follow each other without padding.
+_Static_assert(sizeof(POSDB_HEADER) % 8 == 0, "POSDB_HEADER must keep entries aligned");
+_Static_assert(sizeof(POSDB_ENTRY) == 32, "POSDB_ENTRY layout changed");
+
+// A position reached while building, before sorting by hash.
+typedef struct POSDB_RECORD {
+	uint64_t hash;
+	uint32_t replay;
+	uint32_t piece;
+	uint32_t score;
+	uint32_t final_score;
+} POSDB_RECORD;
+
+typedef struct POSDB_RECORDS {
+	POSDB_RECORD *records;
+	size_t count;
+	size_t capacity;
+} POSDB_RECORDS;
+
+// HASHING
+uint64_t posdb_hash(const TETRIS_GAME *game)
+{
+	// One word of occupied cells per row, folded in from the top.
+	uint64_t hash = (uint64_t)game->width << 8 | game->height;
+	for (int row = 0; row < game->height; row++) {
+		uint64_t bits = 0;
+		const char *cells = game->board + row * game->width;
+		for (int col = 0; col < game->width; col++)
+			if (cells[col] != '.')
+				bits |= 1u << col;
+		hash = (hash ^ bits) * 0x9E3779B97F4A7C15u;
+		hash ^= hash >> 29;
+	}
+	// Zero is never a valid hash so it cannot be mistaken for anything.
+	return hash ? hash : 1;
+}
+
+// BUILDING
+static bool records_push(POSDB_RECORDS *list, const TETRIS_GAME *game, uint32_t replay,
+			 uint32_t piece)
+{
+	if (list->count == list->capacity) {
+		size_t capacity = list->capacity ? list->capacity * 2 : 4096;
+		POSDB_RECORD *records = realloc(list->records, capacity * sizeof(POSDB_RECORD));
+		if (!records)
+			return false;
+		list->records = records;
+		list->capacity = capacity;
+	}
+	list->records[list->count++] = (POSDB_RECORD){
+		.hash = posdb_hash(game),
+		.replay = replay,
+		.piece = piece,
+		.score = game->score,
+	};
+	return true;
+}
+
+static void records_finish(POSDB_RECORDS *list, size_t first, uint32_t final_score)
+{
+	// The game the positions since first belong to is over.
+	for (size_t i = first; i < list->count; i++)
+		list->records[i].final_score = final_score;
+}
+
+static bool records_add_replay(POSDB_RECORDS *list, const char *path, uint32_t index)
+{
+	// Every board a piece was dealt onto, which is the start of a game and
+	// every lock after it.
+	REPLAY replay;
+	if (!replay_load(path, &replay))
+		return false;
+	TETRIS_GAME game;
+	replay_start(&replay, &game);
+	uint32_t piece = 0;
+	size_t game_start = list->count;
+	bool ok = records_push(list, &game, index, piece++);
+	for (uint32_t i = 0; ok && i < replay.header.count; i++) {
+		REPLAY_OP op = replay.inputs[i].op;
+		if (op == REPLAY_RESET) {
+			records_finish(list, game_start, game.score);
+			game_start = list->count;
+		}
+		int events = replay_apply(&game, op);
+		if (op == REPLAY_RESET || (events & EVENT_PLACE))
+			ok = records_push(list, &game, index, piece++);
+	}
+	// A replay that stops mid game counts with the score it got to.
+	records_finish(list, game_start, game.score);
+	replay_free(&replay);
+	return ok;
+}
+
+static int compare_records(const void *a, const void *b)
+{
+	const POSDB_RECORD *x = a, *y = b;
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	if (x->replay != y->replay)
+		return x->replay < y->replay ? -1 : 1;
+	return (x->piece > y->piece) - (x->piece < y->piece);
+}
+
+static bool write_database(const char *path, const POSDB_RECORDS *list,
+			   const char *const *replays, int count)
+{
+	// Equal boards are next to each other once sorted, each run becomes
+	// one entry and its locations.
+	POSDB_HEADER header = {
+		.magic = POSDB_MAGIC,
+		.version = POSDB_VERSION,
+		.replays = count,
+		.locations = list->count,
+		.buckets = 2,
+	};
+	for (size_t i = 0; i < list->count; i++)
+		if (i == 0 || list->records[i].hash != list->records[i - 1].hash)
+			header.positions++;
+	while (header.buckets < header.positions * 2)
+		header.buckets <<= 1;
+	for (int i = 0; i < count; i++)
+		header.names_size += strlen(replays[i]) + 1;
+
+	POSDB_ENTRY *entries = calloc(header.buckets, sizeof(POSDB_ENTRY));
+	POSDB_LOCATION *locations = malloc((list->count + 1) * sizeof(POSDB_LOCATION));
+	uint32_t *name_offsets = malloc((count + 1) * sizeof(uint32_t));
+	bool ok = entries && locations && name_offsets;
+	for (size_t i = 0; ok && i < list->count;) {
+		const POSDB_RECORD *first = &list->records[i];
+		uint64_t slot = first->hash & (header.buckets - 1);
+		while (entries[slot].count)
+			slot = (slot + 1) & (header.buckets - 1);
+		POSDB_ENTRY *entry = &entries[slot];
+		entry->hash = first->hash;
+		entry->first_location = i;
+		for (; i < list->count && list->records[i].hash == first->hash; i++) {
+			const POSDB_RECORD *r = &list->records[i];
+			locations[i] = (POSDB_LOCATION){ .replay = r->replay, .piece = r->piece };
+			entry->count++;
+			entry->final_score += r->final_score;
+			entry->score_to_come += r->final_score - r->score;
+		}
+	}
+
+	FILE *file = ok ? fopen(path, "wb") : NULL;
+	if (file) {
+		uint32_t offset = 0;
+		for (int i = 0; i < count; i++) {
+			name_offsets[i] = offset;
+			offset += strlen(replays[i]) + 1;
+		}
+		ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		     fwrite(entries, sizeof(POSDB_ENTRY), header.buckets, file) == header.buckets &&
+		     fwrite(locations, sizeof(POSDB_LOCATION), list->count, file) == list->count &&
+		     fwrite(name_offsets, sizeof(uint32_t), count, file) == (size_t)count;
+		for (int i = 0; ok && i < count; i++)
+			ok = fwrite(replays[i], strlen(replays[i]) + 1, 1, file) == 1;
+		ok = fclose(file) == 0 && ok;
+	} else {
+		ok = false;
+	}
+	free(entries);
+	free(locations);
+	free(name_offsets);
+	return ok;
+}
+
+bool posdb_build(const char *path, const char *const *replays, int count)
+{
+	POSDB_RECORDS list = { 0 };
+	bool ok = true;
+	for (int i = 0; ok && i < count; i++) {
+		ok = records_add_replay(&list, replays[i], i);
+		if (!ok)
+			fprintf(stderr, "Unable to read replay %s\n", replays[i]);
+	}
+	if (ok && list.count > UINT32_MAX) {
+		fprintf(stderr, "%zu positions are more than a database can index\n", list.count);
+		ok = false;
+	}
+	if (ok) {
+		qsort(list.records, list.count, sizeof(POSDB_RECORD), compare_records);
+		ok = write_database(path, &list, replays, count);
+	}
+	free(list.records);
+	return ok;
+}
+
+// QUERIES
+bool posdb_open(POSDB *db, const char *path)
+{
+	memset(db, 0, sizeof(*db));
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(POSDB_HEADER)) {
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	// The magic also rejects databases from a machine of other endianness.
+	// Every section is checked against what is left of the file before it
+	// is added, so no header can overflow the sum. Entries are not walked,
+	// opening stays free; the accessors bound what they read instead.
+	const POSDB_HEADER *header = map;
+	uint64_t left = st.st_size - sizeof(*header);
+	bool ok = header->magic == POSDB_MAGIC && header->version == POSDB_VERSION &&
+		  header->buckets && !(header->buckets & (header->buckets - 1)) &&
+		  header->buckets <= left / sizeof(POSDB_ENTRY);
+	if (ok) {
+		left -= header->buckets * sizeof(POSDB_ENTRY);
+		ok = header->locations <= left / sizeof(POSDB_LOCATION);
+	}
+	if (ok) {
+		left -= header->locations * sizeof(POSDB_LOCATION);
+		ok = header->replays <= left / sizeof(uint32_t);
+	}
+	if (ok) {
+		left -= header->replays * sizeof(uint32_t);
+		// Names are NUL terminated, the last one too.
+		ok = header->names_size == left && header->names_size > 0 &&
+		     ((const char *)map)[st.st_size - 1] == '\0';
+	}
+	if (!ok) {
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	db->map = map;
+	db->size = st.st_size;
+	db->header = header;
+	db->entries = (const POSDB_ENTRY *)(header + 1);
+	db->locations = (const POSDB_LOCATION *)(db->entries + header->buckets);
+	db->name_offsets = (const uint32_t *)(db->locations + header->locations);
+	db->names = (const char *)(db->name_offsets + header->replays);
+	return true;
+}
+
+void posdb_close(POSDB *db)
+{
+	if (db->map)
+		munmap(db->map, db->size);
+	memset(db, 0, sizeof(*db));
+}
+
+const POSDB_ENTRY *posdb_find(const POSDB *db, uint64_t hash)
+{
+	// Linear probing in a table at most half full: one or two cache lines.
+	// Bounded all the same, a damaged table may have no empty bucket.
+	uint64_t mask = db->header->buckets - 1;
+	uint64_t slot = hash & mask;
+	for (uint64_t probes = 0; probes <= mask && db->entries[slot].count; probes++) {
+		if (db->entries[slot].hash == hash)
+			return &db->entries[slot];
+		slot = (slot + 1) & mask;
+	}
+	return NULL;
+}
+
+const POSDB_LOCATION *posdb_locations(const POSDB *db, const POSDB_ENTRY *entry)
+{
+	if ((uint64_t)entry->first_location + entry->count > db->header->locations)
+		return NULL;
+	return db->locations + entry->first_location;
+}
+
+const char *posdb_replay_name(const POSDB *db, uint32_t replay)
+{
+	// Any offset inside the names runs into a NUL before their end.
+	if (replay >= db->header->replays || db->name_offsets[replay] >= db->header->names_size)
+		return NULL;
+	return db->names + db->name_offsets[replay];
+}
@@ -0,0 +1,75 @@
+#ifndef POSDB_H
+#define POSDB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "engine.h"
+
+// POSITION DATABASE FORMAT
+// A header, an open addressed hash table of positions, the locations of
+// every position grouped by entry, and the names of the replays. The file
+// is mapped as is, nothing is parsed or loaded on open.
+#define POSDB_MAGIC 0x42445350u
+#define POSDB_VERSION 1
+
+typedef struct POSDB_HEADER {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t replays;
+	uint32_t padding;
+	// Hash table size, a power of two at most half full
+	uint64_t buckets;
+	// Distinct boards
+	uint64_t positions;
+	uint64_t locations;
+	uint64_t names_size;
+} POSDB_HEADER;
+
+// A board and how games went on from it. Empty buckets have count 0.
+typedef struct POSDB_ENTRY {
+	uint64_t hash;
+	// Entries stay 32 bytes, so a database holds at most UINT32_MAX
+	// locations and posdb_build refuses more.
+	uint32_t count;
+	uint32_t first_location;
+	// Sums over every time it was reached, of the game's final score and
+	// of the score still to come from here.
+	uint64_t final_score;
+	uint64_t score_to_come;
+} POSDB_ENTRY;
+
+// A piece about to be played on the board: replay and piece number in it.
+typedef struct POSDB_LOCATION {
+	uint32_t replay;
+	uint32_t piece;
+} POSDB_LOCATION;
+
+typedef struct POSDB {
+	void *map;
+	size_t size;
+	const POSDB_HEADER *header;
+	const POSDB_ENTRY *entries;
+	const POSDB_LOCATION *locations;
+	const uint32_t *name_offsets;
+	const char *names;
+} POSDB;
+
+// Of the settled board only, the piece in play is not part of a position.
+uint64_t posdb_hash(const TETRIS_GAME *game);
+
+// Plays through every replay and writes the database. Returns false if a
+// replay cannot be read or the file cannot be written.
+bool posdb_build(const char *path, const char *const *replays, int count);
+
+bool posdb_open(POSDB *db, const char *path);
+void posdb_close(POSDB *db);
+// NULL for a board that never came up.
+const POSDB_ENTRY *posdb_find(const POSDB *db, uint64_t hash);
+// The entry's count locations. Both return NULL for what a damaged file
+// points outside of itself.
+const POSDB_LOCATION *posdb_locations(const POSDB *db, const POSDB_ENTRY *entry);
+const char *posdb_replay_name(const POSDB *db, uint32_t replay);
+
+#endif
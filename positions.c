@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "engine.h"
+#include "posdb.h"
+#include "replay.h"
+
+// QUERY SETTINGS
+#define DEFAULT_TOP 10
+// Lookups are timed in batches, a single one is below the clock resolution.
+#define QUERY_ROUNDS 1000
+
+// TIMING FUNCTIONS
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// POSITION FUNCTIONS
+static bool seek_position(const POSDB *db, POSDB_LOCATION location, TETRIS_GAME *game)
+{
+	// Plays the replay up to the piece, counting pieces the way
+	// posdb_build does.
+	const char *name = posdb_replay_name(db, location.replay);
+	REPLAY replay;
+	if (!name || !replay_load(name, &replay))
+		return false;
+	replay_start(&replay, game);
+	uint32_t piece = 0;
+	for (uint32_t i = 0; piece < location.piece && i < replay.header.count; i++) {
+		REPLAY_OP op = replay.inputs[i].op;
+		int events = replay_apply(game, op);
+		if (op == REPLAY_RESET || (events & EVENT_PLACE))
+			piece++;
+	}
+	replay_free(&replay);
+	return piece == location.piece;
+}
+
+static void print_board(const TETRIS_GAME *game)
+{
+	// From the row above the stack down, the empty sky says nothing.
+	int top = game->height - 1;
+	for (int i = game->width * game->height - 1; i >= 0; i--)
+		if (game->board[i] != '.')
+			top = i / game->width;
+	for (int row = top ? top - 1 : 0; row < game->height; row++) {
+		printf("  |");
+		for (int col = 0; col < game->width; col++)
+			putchar(game->board[row * game->width + col] == '.' ? ' ' : '#');
+		printf("|\n");
+	}
+	printf("  +");
+	for (int col = 0; col < game->width; col++)
+		putchar('-');
+	printf("+\n");
+}
+
+static void print_entry(const POSDB_ENTRY *entry)
+{
+	printf("seen %u times, final score %.1f, score to come %.1f",
+	       entry->count, (double)entry->final_score / entry->count,
+	       (double)entry->score_to_come / entry->count);
+}
+
+// COMMANDS
+static int query(const POSDB *db, const char *path)
+{
+	// Every position of the replay, then the time a lookup takes.
+	REPLAY replay;
+	if (!replay_load(path, &replay)) {
+		fprintf(stderr, "Unable to read replay %s\n", path);
+		return 1;
+	}
+	TETRIS_GAME *games = malloc((replay.header.count + 1) * sizeof(TETRIS_GAME));
+	if (!games) {
+		replay_free(&replay);
+		return 1;
+	}
+	TETRIS_GAME game;
+	replay_start(&replay, &game);
+	uint32_t count = 0;
+	games[count++] = game;
+	for (uint32_t i = 0; i < replay.header.count; i++) {
+		REPLAY_OP op = replay.inputs[i].op;
+		int events = replay_apply(&game, op);
+		if (op == REPLAY_RESET || (events & EVENT_PLACE))
+			games[count++] = game;
+	}
+
+	uint32_t found = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		const POSDB_ENTRY *entry = posdb_find(db, posdb_hash(&games[i]));
+		printf("piece %5u: ", i);
+		if (entry) {
+			print_entry(entry);
+			found++;
+		} else {
+			printf("new position");
+		}
+		putchar('\n');
+	}
+
+	// The same boards again, hashing included since a caller has to as well.
+	uint64_t sum = 0;
+	double start = now_seconds();
+	for (int round = 0; round < QUERY_ROUNDS; round++) {
+		for (uint32_t i = 0; i < count; i++) {
+			const POSDB_ENTRY *entry = posdb_find(db, posdb_hash(&games[i]));
+			sum += entry ? entry->count : 0;
+		}
+	}
+	double elapsed = now_seconds() - start;
+	printf("%u of %u positions known, %.3f us per lookup (%llu)\n", found, count,
+	       elapsed / ((double)count * QUERY_ROUNDS) * 1e6, (unsigned long long)sum);
+	free(games);
+	replay_free(&replay);
+	return 0;
+}
+
+static int compare_counts(const void *a, const void *b)
+{
+	const POSDB_ENTRY *x = *(const POSDB_ENTRY *const *)a, *y = *(const POSDB_ENTRY *const *)b;
+	return (x->count < y->count) - (x->count > y->count);
+}
+
+static int top(const POSDB *db, int n)
+{
+	// The most common boards, drawn from the first time they came up.
+	const POSDB_ENTRY **entries = malloc((db->header->positions + 1) * sizeof(*entries));
+	if (!entries)
+		return 1;
+	uint64_t count = 0;
+	for (uint64_t i = 0; i < db->header->buckets; i++)
+		if (db->entries[i].count)
+			entries[count++] = &db->entries[i];
+	qsort(entries, count, sizeof(*entries), compare_counts);
+	for (uint64_t i = 0; i < count && i < (uint64_t)n; i++) {
+		const POSDB_LOCATION *locations = posdb_locations(db, entries[i]);
+		printf("#%llu %016llx ", (unsigned long long)i + 1,
+		       (unsigned long long)entries[i]->hash);
+		print_entry(entries[i]);
+		putchar('\n');
+		const char *name = locations ? posdb_replay_name(db, locations[0].replay) : NULL;
+		if (!name) {
+			printf("  damaged location\n");
+			continue;
+		}
+		printf("  first in %s, piece %u\n", name, locations[0].piece);
+		TETRIS_GAME game;
+		if (seek_position(db, locations[0], &game))
+			print_board(&game);
+	}
+	free(entries);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s build DB REPLAY...\n"
+		"       %s query DB REPLAY\n"
+		"       %s top DB [N]\n"
+		"Indexes every board a piece was dealt onto in the replays, with how\n"
+		"often it came up and how the games went on from it.\n", name, name, name);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char *command = argv[1], *path = argv[2];
+
+	if (!strcmp(command, "build") && argc > 3) {
+		double start = now_seconds();
+		if (!posdb_build(path, (const char *const *)argv + 3, argc - 3)) {
+			fprintf(stderr, "Unable to build %s\n", path);
+			return 1;
+		}
+		POSDB db;
+		if (!posdb_open(&db, path)) {
+			fprintf(stderr, "Unable to open %s\n", path);
+			return 1;
+		}
+		printf("%s: %u replays, %llu positions, %llu locations, %zu bytes in %.2f s\n",
+		       path, db.header->replays, (unsigned long long)db.header->positions,
+		       (unsigned long long)db.header->locations, db.size, now_seconds() - start);
+		posdb_close(&db);
+		return 0;
+	}
+
+	bool is_query = !strcmp(command, "query") && argc == 4;
+	bool is_top = !strcmp(command, "top") && argc <= 4;
+	if (!is_query && !is_top) {
+		usage(argv[0]);
+		return 1;
+	}
+	POSDB db;
+	if (!posdb_open(&db, path)) {
+		fprintf(stderr, "Unable to open %s\n", path);
+		return 1;
+	}
+	int result = is_query ? query(&db, argv[3])
+			      : top(&db, argc == 4 ? atoi(argv[3]) : DEFAULT_TOP);
+	posdb_close(&db);
+	return result;
+}
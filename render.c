@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "tetris.h"
+#include "font.h"
+#include "tiles_rgba.h"
+
+// RENDER FUNCTIONS
+static SDL_Rect transform_coords(const TETRIS_LAYOUT *layout, int x, int y)
+{
+	return (SDL_Rect){
+		       .x = (x + LEFT_OFFSET) * layout->square,
+		       .y = layout->window_height - (layout->height - y + 1) * layout->square,
+		       .w = layout->square,
+		       .h = layout->square,
+	};
+}
+
+static void draw_tile(SDL_Renderer *renderer, SDL_Rect dst_rect, SDL_Texture *tex, char c)
+{
+	int index = -1;
+	switch (c) {
+	case 0:
+		index = 0;
+		break;
+	case 'I':
+		index = 1;
+		break;
+	case 'O':
+		index = 2;
+		break;
+	case 'T':
+		index = 3;
+		break;
+	case 'S':
+		index = 4;
+		break;
+	case 'Z':
+		index = 5;
+		break;
+	case 'J':
+		index = 6;
+		break;
+	case 'L':
+		index = 7;
+		break;
+	default:
+		return;
+	}
+	SDL_Rect src_rect = { index * 32, 0, 32, 32 };
+	SDL_RenderCopy(renderer, tex, &src_rect, &dst_rect);
+}
+
+static void draw_ghost_tile(TETRIS_STATE *tetris, int x, int y)
+{
+	SDL_Rect dst_rect = transform_coords(&tetris->layout, x, y);
+	SDL_SetRenderDrawColor(tetris->renderer, 255, 255, 255, 125);
+	SDL_RenderDrawRect(tetris->renderer, &dst_rect);
+	SDL_SetRenderDrawColor(tetris->renderer, 0, 0, 0, 255);
+}
+
+static void draw_tetromino_tile(TETRIS_STATE *tetris, char t, int x, int y)
+{
+	SDL_Rect dst_rect = transform_coords(&tetris->layout, x, y);
+	draw_tile(tetris->renderer, dst_rect, tetris->tiles, t);
+}
+
+static void draw_tetromino_preview_tile(TETRIS_STATE *tetris, TETROMINO t,
+					int x, int y)
+{
+	// Position of the top left quad
+	const int half = tetris->layout.square / 2;
+	SDL_Rect start_rect = transform_coords(&tetris->layout, x, y);
+	start_rect.w = half;
+	start_rect.h = half;
+	for (int i = 0; i < TETROMINO_SIZE; i++) {
+		int sub_x = i % TETROMINO_WIDTH;
+		int sub_y = i / TETROMINO_WIDTH;
+		SDL_Rect dst_rect = start_rect;
+		dst_rect.x += half * sub_x;
+		dst_rect.y += half * sub_y;
+		char c = tetromino[t][i];
+		draw_tile(tetris->renderer, dst_rect, tetris->tiles, c);
+	}
+}
+
+static void draw_font(TETRIS_STATE *tetris, TTF_Font *font, int x, int y,
+		      const char *str)
+{
+	static SDL_Color c = { 255, 255, 255, 255 };
+	SDL_Renderer *renderer = tetris->renderer;
+	SDL_Surface *surface = TTF_RenderText_Solid(font, str, c);
+	SDL_Rect pos = {
+		.x = tetris->layout.square * (x + 1) + 2,
+		.y = (surface->h * y) + (TOP_OFFSET * tetris->layout.square),
+	};
+	pos.w = surface->w;
+	pos.h = surface->h;
+	SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
+	SDL_FreeSurface(surface);
+	SDL_RenderCopy(renderer, texture, NULL, &pos);
+	SDL_DestroyTexture(texture);
+}
+
+// RENDER PRESETS
+
+void draw_border(TETRIS_STATE *tetris)
+{
+	// Draw board box
+	const int width = tetris->layout.width;
+	const int height = tetris->layout.height;
+	// Vertical barriers
+	for (int i = 0; i < height; i++) {
+		draw_tetromino_tile(tetris, 0, -LEFT_OFFSET, i); // LEFT EDGE
+		draw_tetromino_tile(tetris, 0, width, i); // RIGHT EDGE
+		draw_tetromino_tile(tetris, 0, -1, i);   // UI EDGE
+	}
+	// Horizontal barriers
+	for (int i = 0 - LEFT_OFFSET; i < width + LEFT_OFFSET + RIGHT_OFFSET; i++) {
+		draw_tetromino_tile(tetris, 0, i, height); // TOP
+		draw_tetromino_tile(tetris, 0, i, -1); // BOTTOM
+		if (i < 0)
+			draw_tetromino_tile(tetris, 0, i, UI_OFFSET); // UI SEPERATOR
+	}
+}
+
+void draw_ui(TETRIS_STATE *tetris, uint32_t timestamp)
+{
+	const int square = tetris->layout.square;
+	const SDL_Rect viewport = {
+		.x = (1) * square,
+		.y = (1) * square,
+		.w = (LEFT_OFFSET - 2) * square,
+		.h = (UI_OFFSET)*square,
+	};
+	SDL_RenderFillRect(tetris->renderer, &viewport);
+
+	// Draw score, level and time
+	char time[] = "Time:           ";
+	uint16_t mins = timestamp / 1000 / 60;
+	uint16_t secs = (timestamp / 1000) % 60;
+	sprintf(time + 6, " %.2u: %.2u", mins, secs);
+	draw_font(tetris, tetris->font, 0, 0, time);
+	char level[] = "Level:           ";
+	sprintf(level + 7, " %u", tetris->game.level);
+	draw_font(tetris, tetris->font, 0, 1, level);
+	char score[] = "Score:";
+	draw_font(tetris, tetris->font, 0, 2, score);
+	char points[9];
+	sprintf(points, "%.8d", tetris->game.score);
+	draw_font(tetris, tetris->font, 0, 3, points);
+}
+
+void draw_bag(TETRIS_STATE *tetris)
+{
+	// Clear the bag location
+	const TETRIS_LAYOUT *layout = &tetris->layout;
+	const SDL_Rect viewport = {
+		.x = (1) * layout->square,
+		.y = (UI_OFFSET + 2) * layout->square,
+		.w = (LEFT_OFFSET - 2) * layout->square,
+		.h = (layout->height - UI_OFFSET - 1) * layout->square,
+	};
+	SDL_RenderFillRect(tetris->renderer, &viewport);
+
+	// Starting grid in the large grid sizes
+	int x = 1 - LEFT_OFFSET;
+	int y = UI_OFFSET + 1;
+	// Draw each preview tetromino
+	for (int p = tetris->game.bag_position; p < NUM_TETROMINO; p++) {
+		int position = p - tetris->game.bag_position;
+		TETROMINO t = tetris->game.tetromino_bag[p];
+		int new_y = y + (position * TETROMINO_WIDTH / 2);
+		// We dont want to write out of our section
+		if (new_y + (TETROMINO_WIDTH / 2) > layout->height)
+			break;
+
+		draw_tetromino_preview_tile(tetris, t, x, new_y);
+	}
+}
+
+static void draw_placed(TETRIS_STATE *tetris)
+{
+	// Draw board state
+	const int width = tetris->game.width;
+	for (int i = 0; i < width * tetris->game.height; i++) {
+		draw_tetromino_tile(tetris, tetris->game.board[i], (i % width), (i / width));
+	}
+}
+
+static void draw_piece(TETRIS_STATE *tetris)
+{
+	TETRIS_GAME *game = &tetris->game;
+	int drop_y = tetromino_drop_location(game);
+	// Draw falling piece
+	for (int i = 0; i < TETROMINO_SIZE; i++) {
+		// Skip empty spaces
+		if (tetromino[game->tetromino_type][i] == '.')
+			continue;
+
+		int sub_x = i % TETROMINO_WIDTH;
+		int sub_y = i / TETROMINO_WIDTH;
+		int rotatedIndex =
+			tetromino_translate_rotation(sub_x, sub_y,
+						     game->tetromino_type,
+						     game->tetromino_rotation);
+		sub_x = rotatedIndex % TETROMINO_WIDTH;
+		sub_y = rotatedIndex / TETROMINO_WIDTH;
+
+		// No rendering when we overlap.
+		if (drop_y + sub_y >= 0 && drop_y + sub_y != game->tetromino_y + sub_y)
+			draw_ghost_tile(tetris,
+					game->tetromino_x + sub_x,
+					drop_y + sub_y);
+
+		if (game->tetromino_y + sub_y >= 0)
+			draw_tetromino_tile(tetris, tetromino[game->tetromino_type][i],
+					    game->tetromino_x + sub_x,
+					    game->tetromino_y + sub_y);
+	}
+}
+
+static SDL_Rect board_viewport(const TETRIS_LAYOUT *layout)
+{
+	return (SDL_Rect){
+		       .x = (LEFT_OFFSET)*layout->square,
+		       .y = 1 * layout->square,
+		       .w = layout->width * layout->square,
+		       .h = layout->height * layout->square,
+	};
+}
+
+void draw_board(TETRIS_STATE *tetris)
+{
+	const SDL_Rect viewport = board_viewport(&tetris->layout);
+	SDL_RenderFillRect(tetris->renderer, &viewport);
+	draw_placed(tetris);
+	draw_piece(tetris);
+}
+
+void draw_game_over(TETRIS_STATE *tetris)
+{
+	char *game_over = "Game over! Press enter to play again";
+	static SDL_Color c = { 255, 255, 255, 255 };
+	SDL_Surface *surface = TTF_RenderText_Solid(tetris->big_font, game_over, c);
+	SDL_Rect pos = {
+		.x = tetris->layout.window_width / 2 - (surface->w / 2),
+		.y = tetris->layout.window_height / 2,
+		.w = surface->w,
+		.h = surface->h,
+	};
+	SDL_RenderFillRect(tetris->renderer, &pos);
+	SDL_Texture *texture = SDL_CreateTextureFromSurface(tetris->renderer, surface);
+	SDL_FreeSurface(surface);
+	SDL_RenderCopy(tetris->renderer, texture, NULL, &pos);
+	SDL_DestroyTexture(texture);
+}
+
+// ANIMATIONS
+// Drawn over the finished frame, they only ever cover what is underneath.
+static void step_lock_flash(void *ctx, const ANIM *anim, int progress)
+{
+	TETRIS_STATE *tetris = ctx;
+	Uint8 alpha = 160 * (ANIM_SCALE - progress) / ANIM_SCALE;
+	SDL_SetRenderDrawColor(tetris->renderer, 255, 255, 255, alpha);
+	for (int i = 0; i < TETROMINO_WIDTH; i++) {
+		if (anim->lock.cells[i] < 0)
+			continue;
+		SDL_Rect rect = transform_coords(&tetris->layout,
+						 anim->lock.cells[i] % tetris->layout.width,
+						 anim->lock.cells[i] / tetris->layout.width);
+		SDL_RenderFillRect(tetris->renderer, &rect);
+	}
+	SDL_SetRenderDrawColor(tetris->renderer, 0, 0, 0, 255);
+}
+
+static void step_clear_fade(void *ctx, const ANIM *anim, int progress)
+{
+	// The removed rows stay where they were and fade out over the board
+	// that has already dropped into their place.
+	TETRIS_STATE *tetris = ctx;
+	Uint8 alpha = 255 * (ANIM_SCALE - progress) / ANIM_SCALE;
+	SDL_SetRenderDrawColor(tetris->renderer, 0, 0, 0, alpha);
+	SDL_SetTextureAlphaMod(tetris->tiles, alpha);
+	const TETRIS_LAYOUT *layout = &tetris->layout;
+	int n = 0;
+	for (int row = 0; row < layout->height && n < TETROMINO_WIDTH; row++) {
+		if (!(anim->clear.mask & ((uint64_t)1 << row)))
+			continue;
+		SDL_Rect rect = transform_coords(layout, 0, row);
+		rect.w = layout->width * layout->square;
+		SDL_RenderFillRect(tetris->renderer, &rect);
+		for (int col = 0; col < layout->width; col++)
+			draw_tetromino_tile(tetris, anim->clear.rows[n][col], col, row);
+		n++;
+	}
+	SDL_SetTextureAlphaMod(tetris->tiles, 255);
+	SDL_SetRenderDrawColor(tetris->renderer, 0, 0, 0, 255);
+}
+
+static void step_level_up(void *ctx, const ANIM *anim, int progress)
+{
+	// Two pulses over the whole board.
+	(void)anim;
+	TETRIS_STATE *tetris = ctx;
+	int phase = (progress * 2) % ANIM_SCALE;
+	Uint8 alpha = 96 * (ANIM_SCALE - phase) / ANIM_SCALE;
+	const SDL_Rect viewport = board_viewport(&tetris->layout);
+	SDL_SetRenderDrawColor(tetris->renderer, 255, 255, 255, alpha);
+	SDL_RenderFillRect(tetris->renderer, &viewport);
+	SDL_SetRenderDrawColor(tetris->renderer, 0, 0, 0, 255);
+}
+
+void animate_events(TETRIS_STATE *tetris, const TETRIS_GAME *before, int events,
+		    uint32_t now)
+{
+	// Schedule effects for what the engine just did. The engine has moved
+	// on to the next piece, so work out where the last one landed from the
+	// state before the call.
+	if (!(events & EVENT_PLACE))
+		return;
+
+	TETRIS_GAME landed = *before;
+	landed.tetromino_y = tetromino_drop_location(&landed);
+	ANIM *anim = anim_add(&tetris->anims, step_lock_flash, now, LOCK_FLASH_MS);
+	int n = 0;
+	for (int i = 0; i < TETROMINO_SIZE; i++) {
+		if (tetromino[landed.tetromino_type][i] == '.')
+			continue;
+		int index = tetromino_translate_rotation(i % TETROMINO_WIDTH, i / TETROMINO_WIDTH,
+							 landed.tetromino_type,
+							 landed.tetromino_rotation);
+		int y = landed.tetromino_y + index / TETROMINO_WIDTH;
+		int x = landed.tetromino_x + index % TETROMINO_WIDTH;
+		anim->lock.cells[n++] = y < 0 ? -1 : y * landed.width + x;
+	}
+
+	if (events & EVENT_CLEAR) {
+		tetromino_write(&landed);
+		anim = anim_add(&tetris->anims, step_clear_fade, now, CLEAR_FADE_MS);
+		anim->clear.mask = tetris->game.clear_mask;
+		n = 0;
+		for (int row = 0; row < landed.height && n < TETROMINO_WIDTH; row++)
+			if (anim->clear.mask & ((uint64_t)1 << row))
+				memcpy(anim->clear.rows[n++], landed.board + row * landed.width,
+				       landed.width);
+	}
+
+	if (events & EVENT_LEVEL_UP) {
+		anim = anim_add(&tetris->anims, step_level_up, now, LEVEL_UP_MS);
+		anim->level = tetris->game.level;
+	}
+}
+
+void draw_animations(TETRIS_STATE *tetris, uint32_t now)
+{
+	anim_run(&tetris->anims, now, tetris);
+}
+
+// INITIALIZATION FUNCTIONS
+void render_layout(TETRIS_LAYOUT *layout, int width, int height)
+{
+	// Squares are as big as fits the desired height, and the window is
+	// trimmed to a whole number of them to smooth the borders.
+	layout->width = width;
+	layout->height = height;
+	layout->square = DESIRED_HEIGHT / (height + TOP_OFFSET + BOTTOM_OFFSET);
+	layout->window_height = layout->square * (height + TOP_OFFSET + BOTTOM_OFFSET);
+	layout->window_width = layout->square * (width + LEFT_OFFSET + RIGHT_OFFSET);
+	layout->font_size = layout->square / 2;
+	layout->big_font_size = layout->square;
+}
+
+void render_load_assets(TETRIS_STATE *tetris)
+{
+	// Fonts and tile atlas for whatever renderer the state has, window or
+	// not. Every font size is opened here once, never while playing.
+	tetris->font =
+		TTF_OpenFontRW(SDL_RWFromConstMem(res_font_otf, res_font_otf_len),
+			       1, tetris->layout.font_size);
+	tetris->big_font =
+		TTF_OpenFontRW(SDL_RWFromConstMem(res_font_otf, res_font_otf_len),
+			       1, tetris->layout.big_font_size);
+	// The tiles were decoded at build time, see png2raw.c.
+	tetris->tiles = SDL_CreateTexture(tetris->renderer, SDL_PIXELFORMAT_RGBA32,
+					  SDL_TEXTUREACCESS_STATIC,
+					  res_tiles_rgba_width, res_tiles_rgba_height);
+	SDL_UpdateTexture(tetris->tiles, NULL, res_tiles_rgba, res_tiles_rgba_width * 4);
+	SDL_SetTextureBlendMode(tetris->tiles, SDL_BLENDMODE_BLEND);
+}
+
+void render_free_assets(TETRIS_STATE *tetris)
+{
+	TTF_CloseFont(tetris->font);
+	TTF_CloseFont(tetris->big_font);
+	SDL_DestroyTexture(tetris->tiles);
+}
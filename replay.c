@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+void replay_init(REPLAY *replay, uint32_t seed, int width, int height)
+{
+	memset(replay, 0, sizeof(*replay));
+	replay->header.magic = REPLAY_MAGIC;
+	replay->header.version = REPLAY_VERSION;
+	replay->header.seed = seed;
+	replay->header.width = width;
+	replay->header.height = height;
+}
+
+void replay_free(REPLAY *replay)
+{
+	free(replay->inputs);
+	replay->inputs = NULL;
+	replay->capacity = 0;
+	replay->header.count = 0;
+}
+
+bool replay_record(REPLAY *replay, uint32_t time, REPLAY_OP op)
+{
+	if (replay->header.count == replay->capacity) {
+		size_t capacity = replay->capacity ? replay->capacity * 2 : 1024;
+		REPLAY_INPUT *inputs = realloc(replay->inputs,
+					       capacity * sizeof(REPLAY_INPUT));
+		if (!inputs)
+			return false;
+		replay->inputs = inputs;
+		replay->capacity = capacity;
+	}
+	replay->inputs[replay->header.count++] = (REPLAY_INPUT){
+		.time = time,
+		.op = op,
+	};
+	return true;
+}
+
+bool replay_save(const char *path, const REPLAY *replay)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(&replay->header, sizeof(replay->header), 1, file) == 1 &&
+		  fwrite(replay->inputs, sizeof(REPLAY_INPUT), replay->header.count,
+			 file) == replay->header.count;
+	return fclose(file) == 0 && ok;
+}
+
+bool replay_load(const char *path, REPLAY *replay)
+{
+	memset(replay, 0, sizeof(*replay));
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+	// Version 1 headers stop before the board size.
+	REPLAY_HEADER *header = &replay->header;
+	const size_t v1_size = offsetof(REPLAY_HEADER, width);
+	bool ok = fread(header, v1_size, 1, file) == 1 && header->magic == REPLAY_MAGIC;
+	if (ok && header->version == 1) {
+		header->width = WIDTH;
+		header->height = HEIGHT;
+	} else {
+		ok = ok && header->version == REPLAY_VERSION &&
+		     fread((char *)header + v1_size, sizeof(*header) - v1_size, 1, file) == 1 &&
+		     tetris_board_size_valid(header->width, header->height);
+	}
+	if (ok && replay->header.count) {
+		replay->capacity = replay->header.count;
+		replay->inputs = malloc(replay->capacity * sizeof(REPLAY_INPUT));
+		ok = replay->inputs &&
+		     fread(replay->inputs, sizeof(REPLAY_INPUT), replay->header.count,
+			   file) == replay->header.count;
+	}
+	fclose(file);
+	if (!ok)
+		replay_free(replay);
+	return ok;
+}
+
+// PLAYBACK
+void replay_start(const REPLAY *replay, TETRIS_GAME *game)
+{
+	tetris_game_new(game, replay->header.width, replay->header.height,
+			replay->header.seed);
+}
+
+int replay_apply(TETRIS_GAME *game, REPLAY_OP op)
+{
+	// Same engine calls the game made when recording.
+	switch (op) {
+	case REPLAY_LEFT:
+		return tetromino_move(game, game->tetromino_rotation,
+				      game->tetromino_x - 1, game->tetromino_y) ?
+		       EVENT_MOVE : EVENT_NONE;
+	case REPLAY_RIGHT:
+		return tetromino_move(game, game->tetromino_rotation,
+				      game->tetromino_x + 1, game->tetromino_y) ?
+		       EVENT_MOVE : EVENT_NONE;
+	case REPLAY_ROTATE:
+		return tetromino_move(game, (game->tetromino_rotation + 1) % ROTATIONS,
+				      game->tetromino_x, game->tetromino_y) ?
+		       EVENT_MOVE : EVENT_NONE;
+	case REPLAY_STEP:
+		return tetris_game_step(game);
+	case REPLAY_DROP:
+		return tetris_game_fast_drop(game);
+	case REPLAY_RESET:
+		tetris_game_reset(game, game->rng);
+		return EVENT_NEW_BAG;
+	default:
+		return EVENT_NONE;
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "engine.h"
+
+// REPLAY FORMAT
+// A header followed by count inputs. Inputs are the engine calls that were
+// actually made, so playing them back needs no timing rules at all.
+#define REPLAY_MAGIC 0x59504C52u
+#define REPLAY_VERSION 2
+
+typedef enum REPLAY_OP {
+	REPLAY_LEFT,
+	REPLAY_RIGHT,
+	REPLAY_ROTATE,
+	// Gravity or a soft drop
+	REPLAY_STEP,
+	REPLAY_DROP,
+	// Start a new game, carrying the random state over
+	REPLAY_RESET,
+	NUM_REPLAY_OPS,
+} REPLAY_OP;
+
+typedef struct REPLAY_HEADER {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seed;
+	uint32_t count;
+	// Board size, version 2 on; earlier replays are all on the standard board
+	uint8_t width;
+	uint8_t height;
+	uint8_t padding[2];
+} REPLAY_HEADER;
+
+typedef struct REPLAY_INPUT {
+	// Pause adjusted game time in milliseconds
+	uint32_t time;
+	uint8_t op;
+	uint8_t padding[3];
+} REPLAY_INPUT;
+
+typedef struct REPLAY {
+	REPLAY_HEADER header;
+	REPLAY_INPUT *inputs;
+	size_t capacity;
+} REPLAY;
+
+void replay_init(REPLAY *replay, uint32_t seed, int width, int height);
+void replay_free(REPLAY *replay);
+bool replay_record(REPLAY *replay, uint32_t time, REPLAY_OP op);
+bool replay_save(const char *path, const REPLAY *replay);
+bool replay_load(const char *path, REPLAY *replay);
+
+// PLAYBACK
+void replay_start(const REPLAY *replay, TETRIS_GAME *game);
+int replay_apply(TETRIS_GAME *game, REPLAY_OP op);
+
+#endif
@@ -0,0 +1,1098 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "engine.h"
+#include "spectate.h"
+#include "telemetry.h"
+
+// SERVER SETTINGS
+#define DEFAULT_PORT 7777
+#define DEFAULT_WORKERS 4
+#define DEFAULT_SESSIONS 4096
+#define MAX_EVENTS 256
+#define READ_CHUNK 64
+#define MAX_PENDING 1024
+// Spectators that have not named a session by then are dropped.
+#define PENDING_TIMEOUT 5000
+#define SPECTATOR_QUEUE 16
+
+// SESSION IDS
+// Sent to players on connect and by spectators to pick a game.
+#define SESSION_SLOT_BITS 20
+#define SESSION_SLOT_MASK ((1u << SESSION_SLOT_BITS) - 1)
+#define SESSION_NONE UINT32_MAX
+
+// TIMER WHEEL
+// Slots are WHEEL_TICK ms wide and the wheel spans more than MOVE_DELAY, so a
+// session is never scheduled more than one lap ahead.
+#define WHEEL_TICK 4
+#define WHEEL_SLOTS 512
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+// FRAME LAYOUT
+// status, level, score (2), piece type, rotation, x, y, bag position,
+// bag (7), board.
+#define FRAME_HEADER 16
+#define FRAME_SIZE (FRAME_HEADER + WIDTH * HEIGHT)
+
+// STRUCTURE AND DATA DEFINITIONS
+typedef enum SESSION_STATUS {
+	SESSION_FREE,
+	SESSION_PLAYING,
+	SESSION_PAUSED,
+	SESSION_GAME_OVER,
+} SESSION_STATUS;
+
+typedef enum CONNECTION_KIND {
+	KIND_PLAYER = 1,
+	KIND_SPECTATOR,
+} CONNECTION_KIND;
+
+// First member of everything registered with a worker's epoll. The
+// generation changes whenever the slot is closed.
+typedef struct CONNECTION {
+	uint8_t kind;
+	uint32_t generation;
+} CONNECTION;
+
+// Passed through a worker's handoff pipe, session is SESSION_NONE for players.
+typedef struct HANDOFF {
+	int fd;
+	uint32_t session;
+} HANDOFF;
+
+typedef struct SPECTATOR {
+	CONNECTION conn;
+	// Waiting for a keyframe after joining or falling behind
+	bool resync;
+	uint8_t head;
+	uint8_t count;
+	uint16_t sent;
+	int fd;
+	struct SESSION *session;
+	// Next watcher of the same session, or next free spectator.
+	struct SPECTATOR *next;
+	SPECTATE_FRAME *queue[SPECTATOR_QUEUE];
+} SPECTATOR;
+
+typedef struct SESSION {
+	CONNECTION conn;
+	// Timer wheel links
+	struct SESSION *next;
+	struct SESSION **pprev;
+	uint32_t deadline;
+	// Gravity time left when paused
+	uint32_t remaining;
+	// Timing, mirrors the single player loop
+	uint32_t last_move;
+	uint32_t last_rotate;
+	int fd;
+	uint8_t status;
+	bool dirty;
+	// Pending output, only the latest frame is ever kept.
+	uint16_t out_len;
+	uint16_t out_sent;
+	TETRIS_GAME game;
+	uint8_t out[FRAME_SIZE];
+	// Only allocated while somebody is watching.
+	SPECTATE_ENCODER *encoder;
+	SPECTATOR *watchers;
+	TELEMETRY_GAME telemetry;
+} SESSION;
+
+// A spectator the acceptor holds until its session id is complete.
+typedef struct PENDING {
+	int fd;
+	uint8_t got;
+	uint8_t id[4];
+	uint32_t deadline;
+	// Accept order, or the free list through next.
+	struct PENDING *prev;
+	struct PENDING *next;
+} PENDING;
+
+typedef struct PENDING_POOL {
+	int epoll_fd;
+	PENDING slots[MAX_PENDING];
+	PENDING *free_list;
+	// All share one timeout, so the oldest is always the next to expire.
+	PENDING *oldest;
+	PENDING *newest;
+} PENDING_POOL;
+
+// Acceptor epoll data above this is a pending spectator, below a listener.
+#define PENDING_EVENT ((uint64_t)1 << 32)
+
+typedef struct WORKER {
+	pthread_t thread;
+	int epoll_fd;
+	// Accepted connections are handed over through this pipe.
+	int handoff[2];
+	int id;
+	// Session pool
+	SESSION *sessions;
+	SESSION *free_list;
+	size_t capacity;
+	size_t active;
+	// Spectator pool
+	SPECTATOR *spectators;
+	SPECTATOR *free_spectators;
+	// Gravity timers
+	SESSION *wheel[WHEEL_SLOTS];
+	uint32_t wheel_tick;
+	// Sessions on the wheel
+	size_t timers;
+	// Metrics of this worker's games, NULL unless enabled
+	TELEMETRY_RING *telemetry;
+} WORKER;
+
+static volatile sig_atomic_t running = 1;
+
+// TIMING FUNCTIONS
+static uint32_t server_get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static bool time_before(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) < 0;
+}
+
+// TIMER WHEEL FUNCTIONS
+static void wheel_cancel(WORKER *w, SESSION *s)
+{
+	if (!s->pprev)
+		return;
+	w->timers--;
+	*s->pprev = s->next;
+	if (s->next)
+		s->next->pprev = s->pprev;
+	s->next = NULL;
+	s->pprev = NULL;
+}
+
+static void wheel_schedule(WORKER *w, SESSION *s, uint32_t deadline)
+{
+	wheel_cancel(w, s);
+	w->timers++;
+	s->deadline = deadline;
+	uint32_t tick = deadline / WHEEL_TICK;
+	// Anything already due goes into the next slot to be processed.
+	if (time_before(tick, w->wheel_tick))
+		tick = w->wheel_tick;
+	SESSION **head = &w->wheel[tick & WHEEL_MASK];
+	s->next = *head;
+	if (s->next)
+		s->next->pprev = &s->next;
+	s->pprev = head;
+	*head = s;
+}
+
+static int wheel_timeout(WORKER *w, uint32_t now)
+{
+	// Milliseconds until the next slot with a session in it is due, or -1
+	// to sleep until there is input when there is none.
+	if (!w->timers)
+		return -1;
+	uint32_t tick = w->wheel_tick;
+	while (!w->wheel[tick & WHEEL_MASK])
+		tick++;
+	uint32_t next = tick * WHEEL_TICK;
+	if (!time_before(now, next))
+		return 0;
+	return next - now;
+}
+
+// SPECTATOR FUNCTIONS
+static void spectator_push(SPECTATOR *sp, SPECTATE_FRAME *frame)
+{
+	bool keyframe = frame->data[0] == SPECTATE_KEYFRAME;
+	if (sp->resync && !keyframe)
+		return;
+
+	if (sp->count == SPECTATOR_QUEUE) {
+		// Too slow to keep up: keep the frame on the wire and start over
+		// from the next keyframe.
+		uint8_t keep = sp->sent ? 1 : 0;
+		for (uint8_t i = keep; i < sp->count; i++)
+			spectate_frame_unref(sp->queue[(sp->head + i) % SPECTATOR_QUEUE]);
+		sp->count = keep;
+		if (!keyframe) {
+			sp->resync = true;
+			spectate_request_keyframe(sp->session->encoder);
+			return;
+		}
+	}
+	sp->resync = false;
+	sp->queue[(sp->head + sp->count) % SPECTATOR_QUEUE] = spectate_frame_ref(frame);
+	sp->count++;
+}
+
+static bool spectator_flush(SPECTATOR *sp)
+{
+	// Returns false when the connection is dead.
+	while (sp->count) {
+		SPECTATE_FRAME *frame = sp->queue[sp->head];
+		ssize_t n = send(sp->fd, frame->data + sp->sent, frame->len - sp->sent,
+				 MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		sp->sent += n;
+		if (sp->sent < frame->len)
+			continue;
+		spectate_frame_unref(frame);
+		sp->head = (sp->head + 1) % SPECTATOR_QUEUE;
+		sp->count--;
+		sp->sent = 0;
+	}
+	return true;
+}
+
+static void spectator_close(WORKER *w, SPECTATOR *sp)
+{
+	SESSION *s = sp->session;
+	for (SPECTATOR **p = &s->watchers; *p; p = &(*p)->next) {
+		if (*p == sp) {
+			*p = sp->next;
+			break;
+		}
+	}
+	if (!s->watchers) {
+		free(s->encoder);
+		s->encoder = NULL;
+	}
+	for (uint8_t i = 0; i < sp->count; i++)
+		spectate_frame_unref(sp->queue[(sp->head + i) % SPECTATOR_QUEUE]);
+	close(sp->fd);
+	sp->fd = -1;
+	sp->conn.kind = 0;
+	sp->conn.generation++;
+	sp->session = NULL;
+	sp->next = w->free_spectators;
+	w->free_spectators = sp;
+}
+
+static bool spectator_read(SPECTATOR *sp)
+{
+	// Spectators have nothing to say, only notice when they leave.
+	char buf[READ_CHUNK];
+	while (true) {
+		ssize_t n = recv(sp->fd, buf, sizeof(buf), 0);
+		if (n == 0)
+			return false;
+		if (n < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	}
+}
+
+// SESSION FUNCTIONS
+static void session_schedule(WORKER *w, SESSION *s)
+{
+	int delay = tetris_move_delay(&s->game);
+	if (delay < MIN_MOVE_DELAY)
+		delay = MIN_MOVE_DELAY;
+	wheel_schedule(w, s, s->last_move + delay);
+}
+
+static uint32_t session_id(WORKER *w, SESSION *s)
+{
+	return ((uint32_t)w->id << SESSION_SLOT_BITS) | (uint32_t)(s - w->sessions);
+}
+
+static void session_observe(SESSION *s, int events)
+{
+	if (s->encoder)
+		spectate_observe(s->encoder, &s->game, events);
+}
+
+static void session_encode(SESSION *s)
+{
+	TETRIS_GAME *game = &s->game;
+	uint8_t *out = s->out;
+	out[0] = s->status;
+	out[1] = game->level;
+	out[2] = game->score >> 8;
+	out[3] = game->score & 0xFF;
+	out[4] = game->tetromino_type;
+	out[5] = game->tetromino_rotation;
+	out[6] = (uint8_t)game->tetromino_x;
+	out[7] = (uint8_t)game->tetromino_y;
+	out[8] = game->bag_position;
+	memcpy(out + 9, game->tetromino_bag, NUM_TETROMINO);
+	memcpy(out + FRAME_HEADER, game->board, WIDTH * HEIGHT);
+	s->out_len = FRAME_SIZE;
+	s->out_sent = 0;
+}
+
+static bool session_flush(SESSION *s)
+{
+	// Returns false when the connection is dead.
+	while (true) {
+		if (s->out_sent == s->out_len) {
+			if (!s->dirty)
+				return true;
+			session_encode(s);
+			s->dirty = false;
+		}
+		ssize_t n = send(s->fd, s->out + s->out_sent,
+				 s->out_len - s->out_sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			// Wait for EPOLLOUT, a newer frame may replace this one.
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		s->out_sent += n;
+	}
+}
+
+static void session_publish(WORKER *w, SESSION *s)
+{
+	// Encode once for every spectator of this game.
+	if (!s->encoder)
+		return;
+	SPECTATE_FRAME *frame = spectate_flush(s->encoder, &s->game, s->status);
+	if (!frame)
+		return;
+	SPECTATOR *next;
+	for (SPECTATOR *sp = s->watchers; sp; sp = next) {
+		next = sp->next;
+		spectator_push(sp, frame);
+		if (!spectator_flush(sp))
+			spectator_close(w, sp);
+	}
+	spectate_frame_unref(frame);
+}
+
+static SESSION *session_open(WORKER *w, int fd)
+{
+	SESSION *s = w->free_list;
+	if (!s)
+		return NULL;
+	w->free_list = s->next;
+	w->active++;
+
+	uint32_t seed = s->game.rng ^ (uint32_t)fd ^ server_get_time();
+	uint32_t generation = s->conn.generation;
+	memset(s, 0, sizeof(*s));
+	s->conn.kind = KIND_PLAYER;
+	s->conn.generation = generation;
+	s->fd = fd;
+	s->status = SESSION_PLAYING;
+	s->last_move = server_get_time();
+	tetris_game_new(&s->game, WIDTH, HEIGHT, seed);
+	telemetry_game_start(&s->telemetry, w->telemetry, &s->game, s->last_move);
+
+	// Greet with the id spectators use to find this game.
+	uint32_t id = session_id(w, s);
+	s->out[0] = id >> 24;
+	s->out[1] = id >> 16;
+	s->out[2] = id >> 8;
+	s->out[3] = id;
+	s->out_len = 4;
+	s->dirty = true;
+	session_schedule(w, s);
+	return s;
+}
+
+static void session_close(WORKER *w, SESSION *s)
+{
+	while (s->watchers)
+		spectator_close(w, s->watchers);
+	if (s->status != SESSION_GAME_OVER)
+		telemetry_game_end(&s->telemetry, w->telemetry, &s->game, TELEMETRY_QUIT,
+				   server_get_time());
+	wheel_cancel(w, s);
+	close(s->fd);
+	s->fd = -1;
+	s->conn.kind = 0;
+	s->conn.generation++;
+	s->status = SESSION_FREE;
+	s->next = w->free_list;
+	w->free_list = s;
+	w->active--;
+}
+
+static bool session_update(WORKER *w, SESSION *s)
+{
+	// Send the player and spectators whatever changed. Returns false when
+	// the player is gone.
+	session_publish(w, s);
+	return session_flush(s);
+}
+
+static void session_gravity(WORKER *w, SESSION *s, uint32_t now, bool soft_drop)
+{
+	// Same guard as update_state: give a freshly spawned piece a moment.
+	if (s->last_move + MIN_MOVE_DELAY >= now && s->game.tetromino_y < 0) {
+		if (!s->pprev)
+			wheel_schedule(w, s, s->last_move + MIN_MOVE_DELAY + 1);
+		return;
+	}
+
+	s->last_move = now;
+	// The soft drop key only counts when it stepped the piece.
+	if (soft_drop)
+		telemetry_key(&s->telemetry, w->telemetry, &s->game, TELEMETRY_KEY_DROP, now);
+	int events = tetris_game_step(&s->game);
+	session_observe(s, events);
+	telemetry_events(&s->telemetry, w->telemetry, &s->game, events, now);
+	s->dirty = true;
+	if (events & EVENT_GAME_OVER) {
+		s->status = SESSION_GAME_OVER;
+		wheel_cancel(w, s);
+		return;
+	}
+	session_schedule(w, s);
+}
+
+static void session_input(WORKER *w, SESSION *s, char c, uint32_t now)
+{
+	TETRIS_GAME *game = &s->game;
+	if (s->status == SESSION_GAME_OVER) {
+		if (c == '\n' || c == 'r') {
+			tetris_game_reset(game, game->rng);
+			session_observe(s, EVENT_NONE);
+			telemetry_game_start(&s->telemetry, w->telemetry, game, now);
+			s->status = SESSION_PLAYING;
+			s->last_move = now;
+			s->dirty = true;
+			session_schedule(w, s);
+		}
+		return;
+	}
+	if (s->status == SESSION_PAUSED) {
+		if (c == 'p') {
+			telemetry_resume(&s->telemetry, w->telemetry, now);
+			s->status = SESSION_PLAYING;
+			wheel_schedule(w, s, now + s->remaining);
+			s->dirty = true;
+		}
+		return;
+	}
+
+	switch (c) {
+	// Move left and right
+	case 'a':
+		if (tetromino_move(game, game->tetromino_rotation,
+				   game->tetromino_x - 1, game->tetromino_y)) {
+			telemetry_key(&s->telemetry, w->telemetry, game, TELEMETRY_KEY_MOVE, now);
+			s->dirty = true;
+		}
+		break;
+	case 'd':
+		if (tetromino_move(game, game->tetromino_rotation,
+				   game->tetromino_x + 1, game->tetromino_y)) {
+			telemetry_key(&s->telemetry, w->telemetry, game, TELEMETRY_KEY_MOVE, now);
+			s->dirty = true;
+		}
+		break;
+	// Rotate
+	case 'w':
+		if (now <= s->last_rotate + ROTATION_DELAY)
+			break;
+		if (tetromino_move(game, (game->tetromino_rotation + 1) % ROTATIONS,
+				   game->tetromino_x, game->tetromino_y)) {
+			telemetry_key(&s->telemetry, w->telemetry, game, TELEMETRY_KEY_MOVE, now);
+			s->last_rotate = now;
+			s->dirty = true;
+		}
+		break;
+	// Move down one unit (trigger a state update early)
+	case 's':
+		session_gravity(w, s, now, true);
+		break;
+	// Fast drop
+	case ' ': {
+		if (s->last_move + MIN_MOVE_DELAY >= now)
+			break;
+		int events = tetris_game_fast_drop(game);
+		if (events == EVENT_NONE)
+			break;
+		telemetry_key(&s->telemetry, w->telemetry, game, TELEMETRY_KEY_DROP, now);
+		session_observe(s, events);
+		telemetry_events(&s->telemetry, w->telemetry, game, events, now);
+		s->last_move = now;
+		s->dirty = true;
+		session_schedule(w, s);
+		break;
+	}
+	// Pause
+	case 'p':
+		s->status = SESSION_PAUSED;
+		telemetry_pause(&s->telemetry, w->telemetry, now);
+		s->remaining = time_before(now, s->deadline) ? s->deadline - now : 0;
+		wheel_cancel(w, s);
+		s->dirty = true;
+		break;
+	default:
+		break;
+	}
+}
+
+static bool session_read(WORKER *w, SESSION *s)
+{
+	// Edge triggered, so drain the socket. Returns false on hangup.
+	char buf[READ_CHUNK];
+	while (true) {
+		ssize_t n = recv(s->fd, buf, sizeof(buf), 0);
+		if (n == 0)
+			return false;
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		uint32_t now = server_get_time();
+		for (ssize_t i = 0; i < n; i++) {
+			if (buf[i] == 'q')
+				return false;
+			session_input(w, s, buf[i], now);
+		}
+	}
+}
+
+// WORKER FUNCTIONS
+static bool worker_register(WORKER *w, int fd, const CONNECTION *conn, uint32_t slot)
+{
+	// Events carry the generation, kind and slot, so those still queued
+	// for a connection closed earlier in the batch are not taken for the
+	// one that reused its slot. Zero is the handoff pipe.
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+		.data.u64 = (uint64_t)conn->generation << 32 |
+			    (uint64_t)conn->kind << SESSION_SLOT_BITS | slot,
+	};
+	return epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+static void worker_watch(WORKER *w, int fd, uint32_t id)
+{
+	uint32_t slot = id & SESSION_SLOT_MASK;
+	SPECTATOR *sp = w->free_spectators;
+	if (!sp || slot >= w->capacity ||
+	    w->sessions[slot].status == SESSION_FREE) {
+		close(fd);
+		return;
+	}
+	SESSION *s = &w->sessions[slot];
+	if (!s->encoder) {
+		s->encoder = malloc(sizeof(SPECTATE_ENCODER));
+		if (!s->encoder) {
+			close(fd);
+			return;
+		}
+		spectate_init(s->encoder);
+	}
+	w->free_spectators = sp->next;
+	uint32_t generation = sp->conn.generation;
+	memset(sp, 0, sizeof(*sp));
+	sp->conn.kind = KIND_SPECTATOR;
+	sp->conn.generation = generation;
+	sp->fd = fd;
+	sp->session = s;
+	sp->resync = true;
+	sp->next = s->watchers;
+	s->watchers = sp;
+	if (!worker_register(w, fd, &sp->conn, sp - w->spectators)) {
+		spectator_close(w, sp);
+		return;
+	}
+	// Everybody gets a fresh keyframe, the newcomer has nothing to go on.
+	spectate_request_keyframe(s->encoder);
+	session_publish(w, s);
+}
+
+static void worker_accept(WORKER *w)
+{
+	HANDOFF handoffs[MAX_EVENTS];
+	ssize_t n = read(w->handoff[0], handoffs, sizeof(handoffs));
+	for (ssize_t i = 0; i < n / (ssize_t)sizeof(HANDOFF); i++) {
+		int fd = handoffs[i].fd;
+		// Only a wakeup, see wake_workers.
+		if (fd < 0)
+			continue;
+		if (handoffs[i].session != SESSION_NONE) {
+			worker_watch(w, fd, handoffs[i].session);
+			continue;
+		}
+		SESSION *s = session_open(w, fd);
+		if (!s) {
+			close(fd);
+			continue;
+		}
+		if (!worker_register(w, fd, &s->conn, s - w->sessions) || !session_flush(s))
+			session_close(w, s);
+	}
+}
+
+static void worker_advance(WORKER *w, uint32_t now)
+{
+	// Fire every slot that has come due since the last call. An empty wheel
+	// may have been asleep for long, it just catches up.
+	if (!w->timers && !time_before(now, w->wheel_tick * WHEEL_TICK))
+		w->wheel_tick = now / WHEEL_TICK + 1;
+	while (!time_before(now, w->wheel_tick * WHEEL_TICK)) {
+		SESSION **head = &w->wheel[w->wheel_tick & WHEEL_MASK];
+		SESSION *due = *head;
+		*head = NULL;
+		if (due)
+			due->pprev = &due;
+		w->wheel_tick++;
+		while (due) {
+			SESSION *s = due;
+			wheel_cancel(w, s);
+			session_gravity(w, s, now, false);
+			if (!session_update(w, s))
+				session_close(w, s);
+		}
+	}
+}
+
+static void worker_event(WORKER *w, struct epoll_event *ev)
+{
+	uint32_t generation = ev->data.u64 >> 32;
+	uint32_t kind = (uint32_t)ev->data.u64 >> SESSION_SLOT_BITS;
+	uint32_t slot = ev->data.u64 & SESSION_SLOT_MASK;
+	CONNECTION *conn = kind == KIND_SPECTATOR ? &w->spectators[slot].conn
+						  : &w->sessions[slot].conn;
+	if (conn->kind != kind || conn->generation != generation)
+		return;
+	bool alive = !(ev->events & (EPOLLERR | EPOLLHUP));
+	if (conn->kind == KIND_SPECTATOR) {
+		SPECTATOR *sp = (SPECTATOR *)conn;
+		if (alive && (ev->events & (EPOLLIN | EPOLLRDHUP)))
+			alive = spectator_read(sp);
+		if (alive)
+			alive = spectator_flush(sp);
+		if (!alive)
+			spectator_close(w, sp);
+	} else if (conn->kind == KIND_PLAYER) {
+		SESSION *s = (SESSION *)conn;
+		if (alive && (ev->events & EPOLLIN))
+			alive = session_read(w, s);
+		if (alive)
+			alive = session_update(w, s);
+		if (!alive)
+			session_close(w, s);
+	}
+}
+
+static void *worker_run(void *data)
+{
+	WORKER *w = data;
+	struct epoll_event events[MAX_EVENTS];
+	w->wheel_tick = server_get_time() / WHEEL_TICK;
+	while (running) {
+		int n = epoll_wait(w->epoll_fd, events, MAX_EVENTS,
+				   wheel_timeout(w, server_get_time()));
+		if (n < 0 && errno != EINTR)
+			break;
+		// The wheel is caught up before new input schedules anything, as
+		// it may have slept for most of a lap.
+		worker_advance(w, server_get_time());
+		for (int i = 0; i < n; i++) {
+			if (!events[i].data.u64)
+				worker_accept(w);
+			else
+				worker_event(w, &events[i]);
+		}
+	}
+	return NULL;
+}
+
+static bool worker_init(WORKER *w, int id, size_t capacity)
+{
+	memset(w, 0, sizeof(*w));
+	w->id = id;
+	w->capacity = capacity;
+	w->sessions = calloc(capacity, sizeof(SESSION));
+	w->spectators = calloc(capacity, sizeof(SPECTATOR));
+	if (!w->sessions || !w->spectators)
+		return false;
+	for (size_t i = capacity; i-- > 0;) {
+		w->sessions[i].fd = -1;
+		w->sessions[i].game.rng = i + 1;
+		w->sessions[i].next = w->free_list;
+		w->free_list = &w->sessions[i];
+		w->spectators[i].fd = -1;
+		w->spectators[i].next = w->free_spectators;
+		w->free_spectators = &w->spectators[i];
+	}
+	w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (w->epoll_fd < 0 || pipe2(w->handoff, O_NONBLOCK | O_CLOEXEC) != 0)
+		return false;
+	struct epoll_event ev = { .events = EPOLLIN, .data.u64 = 0 };
+	return epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->handoff[0], &ev) == 0;
+}
+
+static void worker_free(WORKER *w)
+{
+	for (size_t i = 0; i < w->capacity; i++)
+		if (w->sessions[i].status != SESSION_FREE)
+			session_close(w, &w->sessions[i]);
+	free(w->sessions);
+	free(w->spectators);
+	close(w->handoff[0]);
+	close(w->handoff[1]);
+	close(w->epoll_fd);
+}
+
+// INITIALIZATION FUNCTIONS
+static int listen_tcp(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(fd, SOMAXCONN) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int listen_unix(const char *path)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		close(fd);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(fd, SOMAXCONN) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void handle_signal(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [--port N | --unix PATH] [--spectate-port N | --spectate-unix PATH]\n"
+		"          [--workers N] [--sessions N] [--telemetry FILE]\n"
+		"Inputs are single bytes: a/d move, w rotate, s soft drop,\n"
+		"space fast drop, p pause, r restart, q quit.\n"
+		"Spectators send the 4 byte session id a player was greeted with.\n", name);
+}
+
+static void dispatch(WORKER *pool, int worker, int fd, uint32_t session)
+{
+	HANDOFF handoff = { .fd = fd, .session = session };
+	if (write(pool[worker].handoff[1], &handoff, sizeof(handoff)) != sizeof(handoff))
+		close(fd);
+}
+
+static void wake_workers(WORKER *pool, int workers)
+{
+	// Idle workers sleep until there is input, give them some so they see
+	// running is off.
+	HANDOFF wakeup = { .fd = -1, .session = SESSION_NONE };
+	for (int i = 0; i < workers; i++) {
+		// A full pipe wakes the worker just as well.
+		ssize_t n = write(pool[i].handoff[1], &wakeup, sizeof(wakeup));
+		(void)n;
+	}
+}
+
+static int accept_client(int listen_fd, bool tcp)
+{
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd >= 0 && tcp) {
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+// PENDING SPECTATOR FUNCTIONS
+static void pending_init(PENDING_POOL *pending, int epoll_fd)
+{
+	memset(pending, 0, sizeof(*pending));
+	pending->epoll_fd = epoll_fd;
+	for (int i = MAX_PENDING; i-- > 0;) {
+		pending->slots[i].fd = -1;
+		pending->slots[i].next = pending->free_list;
+		pending->free_list = &pending->slots[i];
+	}
+}
+
+static void pending_add(PENDING_POOL *pending, int fd)
+{
+	// An id already sent is reported as soon as the socket is added.
+	PENDING *p = pending->free_list;
+	if (!p) {
+		close(fd);
+		return;
+	}
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLRDHUP | EPOLLET,
+		.data.u64 = PENDING_EVENT + (uint64_t)(p - pending->slots),
+	};
+	if (epoll_ctl(pending->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		close(fd);
+		return;
+	}
+	pending->free_list = p->next;
+	*p = (PENDING){
+		.fd = fd,
+		.deadline = server_get_time() + PENDING_TIMEOUT,
+		.prev = pending->newest,
+	};
+	if (pending->newest)
+		pending->newest->next = p;
+	else
+		pending->oldest = p;
+	pending->newest = p;
+}
+
+static int pending_remove(PENDING_POOL *pending, PENDING *p)
+{
+	// Returns the fd, no longer watched by the acceptor.
+	int fd = p->fd;
+	epoll_ctl(pending->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	if (p->prev)
+		p->prev->next = p->next;
+	else
+		pending->oldest = p->next;
+	if (p->next)
+		p->next->prev = p->prev;
+	else
+		pending->newest = p->prev;
+	p->fd = -1;
+	p->prev = NULL;
+	p->next = pending->free_list;
+	pending->free_list = p;
+	return fd;
+}
+
+static void pending_read(PENDING_POOL *pending, PENDING *p, WORKER *pool, int workers)
+{
+	// Edge triggered, so read until the id is complete or the socket is
+	// empty. Whatever follows the id is left for the worker.
+	while (p->got < sizeof(p->id)) {
+		ssize_t n = recv(p->fd, p->id + p->got, sizeof(p->id) - p->got, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0) {
+			close(pending_remove(pending, p));
+			return;
+		}
+		p->got += n;
+	}
+	uint32_t session = ((uint32_t)p->id[0] << 24) | (p->id[1] << 16) |
+			   (p->id[2] << 8) | p->id[3];
+	int fd = pending_remove(pending, p);
+	int worker = session >> SESSION_SLOT_BITS;
+	if (worker >= workers)
+		close(fd);
+	else
+		dispatch(pool, worker, fd, session);
+}
+
+static int pending_expire(PENDING_POOL *pending, uint32_t now)
+{
+	// Drops everybody out of time, then returns the milliseconds until
+	// the next one is, or -1 if nobody is waiting.
+	while (pending->oldest && !time_before(now, pending->oldest->deadline))
+		close(pending_remove(pending, pending->oldest));
+	if (!pending->oldest)
+		return -1;
+	return pending->oldest->deadline - now;
+}
+
+int main(int argc, char *argv[])
+{
+	int port = DEFAULT_PORT;
+	int spectate_port = 0;
+	const char *unix_path = NULL;
+	const char *spectate_path = NULL;
+	const char *telemetry = NULL;
+	int workers = DEFAULT_WORKERS;
+	long sessions = DEFAULT_SESSIONS;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+			port = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--unix") && i + 1 < argc) {
+			unix_path = argv[++i];
+		} else if (!strcmp(argv[i], "--spectate-port") && i + 1 < argc) {
+			spectate_port = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--spectate-unix") && i + 1 < argc) {
+			spectate_path = argv[++i];
+		} else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+			workers = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--sessions") && i + 1 < argc) {
+			sessions = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "--telemetry") && i + 1 < argc) {
+			telemetry = argv[++i];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (workers < 1 || sessions < 1 ||
+	    (sessions + workers - 1) / workers > SESSION_SLOT_MASK) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	int listen_fd = unix_path ? listen_unix(unix_path) : listen_tcp(port);
+	int spectate_fd = -1;
+	if (spectate_path)
+		spectate_fd = listen_unix(spectate_path);
+	else if (spectate_port)
+		spectate_fd = listen_tcp(spectate_port);
+	if (listen_fd < 0 || ((spectate_path || spectate_port) && spectate_fd < 0)) {
+		perror("listen");
+		return 1;
+	}
+
+	struct sigaction sa = { .sa_handler = handle_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	TELEMETRY_LOG *telemetry_log = NULL;
+	if (telemetry && !(telemetry_log = telemetry_open(telemetry))) {
+		perror("telemetry");
+		return 1;
+	}
+
+	// Sessions are sharded evenly, each worker owns its share outright.
+	size_t per_worker = (sessions + workers - 1) / workers;
+	WORKER *pool = calloc(workers, sizeof(WORKER));
+	for (int i = 0; i < workers; i++) {
+		if (!worker_init(&pool[i], i, per_worker)) {
+			perror("worker");
+			return 1;
+		}
+		pool[i].telemetry = telemetry_ring(telemetry_log);
+		// Its shard would be handed connections nobody serves.
+		int err = pthread_create(&pool[i].thread, NULL, worker_run, &pool[i]);
+		if (err != 0) {
+			fprintf(stderr, "worker: %s\n", strerror(err));
+			return 1;
+		}
+	}
+	fprintf(stderr, "Serving %ld sessions on %d workers (%zu bytes each)\n",
+		(long)per_worker * workers, workers, sizeof(SESSION));
+
+	// The acceptor also holds new spectators until they name a session, so
+	// they can be handed straight to the worker that owns it.
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.u64 = listen_fd };
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+	if (spectate_fd >= 0) {
+		ev.data.u64 = spectate_fd;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, spectate_fd, &ev);
+	}
+	PENDING_POOL *pending = malloc(sizeof(PENDING_POOL));
+	if (!pending) {
+		perror("pending");
+		return 1;
+	}
+	pending_init(pending, epoll_fd);
+
+	int next = 0;
+	struct epoll_event events[MAX_EVENTS];
+	while (running) {
+		// Expired spectators are only dropped between batches, so no
+		// event in a batch is for a slot that was reused within it.
+		int timeout = pending_expire(pending, server_get_time());
+		int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			uint64_t data = events[i].data.u64;
+			if (data >= PENDING_EVENT) {
+				pending_read(pending, &pending->slots[data - PENDING_EVENT],
+					     pool, workers);
+				continue;
+			}
+			int fd = (int)data;
+			if (fd == listen_fd) {
+				int client = accept_client(listen_fd, !unix_path);
+				if (client < 0)
+					continue;
+				dispatch(pool, next, client, SESSION_NONE);
+				next = (next + 1) % workers;
+			} else if (fd == spectate_fd) {
+				int client = accept_client(spectate_fd, !spectate_path);
+				if (client < 0)
+					continue;
+				pending_add(pending, client);
+			}
+		}
+	}
+
+	running = 0;
+	wake_workers(pool, workers);
+	for (int i = 0; i < workers; i++) {
+		pthread_join(pool[i].thread, NULL);
+		worker_free(&pool[i]);
+	}
+	while (pending->oldest)
+		close(pending_remove(pending, pending->oldest));
+	free(pending);
+	telemetry_close(telemetry_log);
+	free(pool);
+	close(epoll_fd);
+	close(listen_fd);
+	if (unix_path)
+		unlink(unix_path);
+	if (spectate_fd >= 0)
+		close(spectate_fd);
+	if (spectate_path)
+		unlink(spectate_path);
+	return 0;
+}
@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "sfx.h"
+
+// AUDIO CALLBACK
+static void start_voice(SFX_MIXER *sfx, const SFX_SOUND *sound)
+{
+	if (!sound->frames)
+		return;
+	// Take a free voice, or cut off whichever has played the longest.
+	SFX_VOICE *voice = &sfx->voices[0];
+	for (int i = 0; i < SFX_MAX_VOICES; i++) {
+		if (!sfx->voices[i].sound) {
+			voice = &sfx->voices[i];
+			break;
+		}
+		if (sfx->voices[i].pos > voice->pos)
+			voice = &sfx->voices[i];
+	}
+	voice->sound = sound;
+	voice->pos = 0;
+}
+
+static void run_commands(SFX_MIXER *sfx)
+{
+	uint32_t tail = atomic_load_explicit(&sfx->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&sfx->head, memory_order_acquire);
+	for (; tail != head; tail++) {
+		const SFX_COMMAND *command = &sfx->queue[tail & (SFX_QUEUE_SIZE - 1)];
+		switch (command->op) {
+		case SFX_PLAY:
+			start_voice(sfx, &sfx->sounds[command->arg]);
+			break;
+		case SFX_STOP:
+			memset(sfx->voices, 0, sizeof(sfx->voices));
+			break;
+		case SFX_VOLUME:
+			sfx->volume = command->arg;
+			break;
+		}
+	}
+	atomic_store_explicit(&sfx->tail, tail, memory_order_release);
+}
+
+static void mix(void *data, Uint8 *stream, int len)
+{
+	// Runs on the audio thread: no locks, no allocation, no waiting.
+	SFX_MIXER *sfx = data;
+	run_commands(sfx);
+
+	int16_t *out = (int16_t *)stream;
+	int total = len / (int)sizeof(int16_t);
+	int32_t sum[SFX_BUFFER_FRAMES * SFX_CHANNELS];
+	for (int done = 0; done < total;) {
+		int n = total - done;
+		if (n > SFX_BUFFER_FRAMES * SFX_CHANNELS)
+			n = SFX_BUFFER_FRAMES * SFX_CHANNELS;
+		memset(sum, 0, n * sizeof(int32_t));
+
+		for (int v = 0; v < SFX_MAX_VOICES; v++) {
+			SFX_VOICE *voice = &sfx->voices[v];
+			if (!voice->sound)
+				continue;
+			const int16_t *src = voice->sound->samples + (size_t)voice->pos * SFX_CHANNELS;
+			uint32_t left = (voice->sound->frames - voice->pos) * SFX_CHANNELS;
+			int count = (uint32_t)n < left ? n : (int)left;
+			for (int i = 0; i < count; i++)
+				sum[i] += src[i];
+			voice->pos += count / SFX_CHANNELS;
+			if (voice->pos >= voice->sound->frames)
+				voice->sound = NULL;
+		}
+
+		for (int i = 0; i < n; i++) {
+			int32_t sample = sum[i] * sfx->volume / SFX_MAX_VOLUME;
+			if (sample > INT16_MAX)
+				sample = INT16_MAX;
+			else if (sample < INT16_MIN)
+				sample = INT16_MIN;
+			out[done + i] = (int16_t)sample;
+		}
+		done += n;
+	}
+}
+
+// GAME THREAD FUNCTIONS
+static void push(SFX_MIXER *sfx, SFX_OP op, uint8_t arg)
+{
+	uint32_t head = atomic_load_explicit(&sfx->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&sfx->tail, memory_order_acquire);
+	// Only possible if the device stalled, a lost effect is better than
+	// waiting on it.
+	if (head - tail == SFX_QUEUE_SIZE)
+		return;
+	sfx->queue[head & (SFX_QUEUE_SIZE - 1)] = (SFX_COMMAND){ .op = op, .arg = arg };
+	atomic_store_explicit(&sfx->head, head + 1, memory_order_release);
+}
+
+void sfx_play(SFX_MIXER *sfx, SFX_ID id)
+{
+	push(sfx, SFX_PLAY, id);
+}
+
+void sfx_stop(SFX_MIXER *sfx)
+{
+	push(sfx, SFX_STOP, 0);
+}
+
+void sfx_volume(SFX_MIXER *sfx, int volume)
+{
+	push(sfx, SFX_VOLUME, volume > SFX_MAX_VOLUME ? SFX_MAX_VOLUME : volume);
+}
+
+// INITIALIZATION FUNCTIONS
+bool sfx_open(SFX_MIXER *sfx)
+{
+	memset(sfx, 0, sizeof(*sfx));
+	sfx->volume = SFX_MAX_VOLUME;
+	SDL_AudioSpec want = {
+		.freq = SFX_FREQUENCY,
+		.format = AUDIO_S16SYS,
+		.channels = SFX_CHANNELS,
+		.samples = SFX_BUFFER_FRAMES,
+		.callback = mix,
+		.userdata = sfx,
+	};
+	// Take whatever rate the device runs at so SDL never has to resample
+	// behind the callback; sounds are converted to it once when loaded.
+	sfx->device = SDL_OpenAudioDevice(NULL, 0, &want, &sfx->spec,
+					  SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if (!sfx->device)
+		return false;
+	SDL_PauseAudioDevice(sfx->device, 0);
+	return true;
+}
+
+bool sfx_load(SFX_MIXER *sfx, SFX_ID id, SDL_RWops *src)
+{
+	// May run on a loading thread while the callback is going: the sound
+	// is only touched by the callback once a play command for it arrives.
+	SDL_AudioSpec spec;
+	Uint8 *wav;
+	Uint32 len;
+	if (!SDL_LoadWAV_RW(src, 1, &spec, &wav, &len))
+		return false;
+
+	SDL_AudioCVT cvt;
+	if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+			      AUDIO_S16SYS, SFX_CHANNELS, sfx->spec.freq) < 0) {
+		SDL_FreeWAV(wav);
+		return false;
+	}
+	cvt.len = len;
+	cvt.buf = SDL_malloc((size_t)len * cvt.len_mult);
+	if (!cvt.buf) {
+		SDL_FreeWAV(wav);
+		return false;
+	}
+	memcpy(cvt.buf, wav, len);
+	SDL_FreeWAV(wav);
+	if (SDL_ConvertAudio(&cvt) != 0) {
+		SDL_free(cvt.buf);
+		return false;
+	}
+
+	sfx->sounds[id].samples = (int16_t *)cvt.buf;
+	sfx->sounds[id].frames = cvt.len_cvt / (sizeof(int16_t) * SFX_CHANNELS);
+	return true;
+}
+
+void sfx_close(SFX_MIXER *sfx)
+{
+	// Waits for a running callback before anything is freed.
+	if (sfx->device)
+		SDL_CloseAudioDevice(sfx->device);
+	for (int i = 0; i < NUM_SFX; i++)
+		SDL_free(sfx->sounds[i].samples);
+	memset(sfx, 0, sizeof(*sfx));
+}
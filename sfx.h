@@ -0,0 +1,76 @@
+#ifndef SFX_H
+#define SFX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include <SDL2/SDL.h>
+
+// EFFECT SETTINGS
+// Sound effects get their own audio device with a small buffer, so they
+// are heard within a few milliseconds of the move that caused them. The
+// music keeps SDL_mixer and its large buffer.
+#define SFX_FREQUENCY 48000
+// Frames per callback, about 5 ms at 48 kHz
+#define SFX_BUFFER_FRAMES 256
+#define SFX_CHANNELS 2
+#define SFX_MAX_VOICES 8
+#define SFX_MAX_VOLUME 128
+// Commands in flight to the callback, must be a power of two
+#define SFX_QUEUE_SIZE 64
+
+typedef enum SFX_ID {
+	SFX_PLACE,
+	SFX_CLEAR,
+	SFX_OVER,
+	SFX_LEVEL_UP,
+	NUM_SFX,
+} SFX_ID;
+
+typedef enum SFX_OP {
+	SFX_PLAY,
+	SFX_STOP,
+	SFX_VOLUME,
+} SFX_OP;
+
+typedef struct SFX_COMMAND {
+	uint8_t op;
+	// Sound to play or the new volume
+	uint8_t arg;
+} SFX_COMMAND;
+
+// Samples already in the device format, interleaved
+typedef struct SFX_SOUND {
+	int16_t *samples;
+	uint32_t frames;
+} SFX_SOUND;
+
+typedef struct SFX_VOICE {
+	const SFX_SOUND *sound;
+	uint32_t pos;
+} SFX_VOICE;
+
+typedef struct SFX_MIXER {
+	SDL_AudioDeviceID device;
+	// What the device actually opened with
+	SDL_AudioSpec spec;
+	SFX_SOUND sounds[NUM_SFX];
+	// Single producer, single consumer: only the game thread moves head
+	// and only the audio callback moves tail, so neither ever locks.
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+	SFX_COMMAND queue[SFX_QUEUE_SIZE];
+	// Owned by the audio callback
+	SFX_VOICE voices[SFX_MAX_VOICES];
+	int volume;
+} SFX_MIXER;
+
+bool sfx_open(SFX_MIXER *sfx);
+bool sfx_load(SFX_MIXER *sfx, SFX_ID id, SDL_RWops *src);
+void sfx_play(SFX_MIXER *sfx, SFX_ID id);
+void sfx_stop(SFX_MIXER *sfx);
+void sfx_volume(SFX_MIXER *sfx, int volume);
+void sfx_close(SFX_MIXER *sfx);
+
+#endif
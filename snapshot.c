@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+// Catch layout changes that forgot to bump SNAPSHOT_VERSION.
+_Static_assert(sizeof(TETRIS_GAME) == 672, "TETRIS_GAME layout changed");
+_Static_assert(offsetof(TETRIS_SNAPSHOT, game) == 32, "snapshot header changed");
+
+void snapshot_init(TETRIS_SNAPSHOT *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+	snap->magic = SNAPSHOT_MAGIC;
+	snap->version = SNAPSHOT_VERSION;
+	snap->size = sizeof(*snap);
+}
+
+static bool cell_valid(char c)
+{
+	// Empty or left behind by one of the pieces, what the tiles can draw.
+	return c && strchr(".IOTSZJL", c);
+}
+
+bool snapshot_valid(const TETRIS_SNAPSHOT *snap)
+{
+	// The magic also rejects snapshots from a machine of other endianness.
+	if (snap->magic != SNAPSHOT_MAGIC || snap->version != SNAPSHOT_VERSION ||
+	    snap->size != sizeof(*snap))
+		return false;
+
+	const TETRIS_GAME *game = &snap->game;
+	if (!tetris_board_size_valid(game->width, game->height) ||
+	    game->tetromino_type >= NUM_TETROMINO ||
+	    game->tetromino_rotation >= ROTATIONS ||
+	    game->bag_position >= NUM_TETROMINO ||
+	    game->tetromino_x <= -TETROMINO_WIDTH || game->tetromino_x >= game->width ||
+	    game->tetromino_y < -TETROMINO_WIDTH || game->tetromino_y >= game->height)
+		return false;
+	// Everything later used as an index, the pieces still to come and the
+	// cells the tiles are picked by.
+	for (int i = 0; i < NUM_TETROMINO; i++)
+		if (game->tetromino_bag[i] >= NUM_TETROMINO)
+			return false;
+	for (int i = 0; i < game->width * game->height; i++)
+		if (!cell_valid(game->board[i]))
+			return false;
+	return true;
+}
+
+bool snapshot_save(const char *path, const TETRIS_SNAPSHOT *snap, bool sync)
+{
+	// Write next to the old file and swap it in, so a power cut leaves
+	// either the old snapshot or the new one.
+	char tmp[FILENAME_MAX];
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return false;
+
+	FILE *file = fopen(tmp, "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(snap, sizeof(*snap), 1, file) == 1 && fflush(file) == 0;
+#ifndef _WIN32
+	ok = ok && (!sync || fsync(fileno(file)) == 0);
+#endif
+	ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (!ok || rename(tmp, path) != 0) {
+		remove(tmp);
+		return false;
+	}
+	return true;
+}
+
+bool snapshot_load(const char *path, TETRIS_SNAPSHOT *snap)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+	bool ok = fread(snap, sizeof(*snap), 1, file) == 1;
+	fclose(file);
+	return ok && snapshot_valid(snap);
+}
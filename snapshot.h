@@ -0,0 +1,38 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "engine.h"
+
+// SNAPSHOT FORMAT
+// Written as one little block so it can be read back with a single read and
+// used in place. Bump SNAPSHOT_VERSION whenever the layout changes.
+#define SNAPSHOT_MAGIC 0x53525454u
+#define SNAPSHOT_VERSION 2
+
+typedef struct TETRIS_SNAPSHOT {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	// Front end status, eg PLAYING or PAUSED
+	uint8_t status;
+	uint8_t padding[3];
+	// Timers, all in pause adjusted game time
+	uint32_t elapsed;
+	uint32_t last_move;
+	uint32_t last_rotate;
+	uint32_t last_ui;
+	// Board, bag, piece, score and random state
+	TETRIS_GAME game;
+} TETRIS_SNAPSHOT;
+
+void snapshot_init(TETRIS_SNAPSHOT *snap);
+bool snapshot_valid(const TETRIS_SNAPSHOT *snap);
+// Without sync a power cut may still lose the newest snapshot, never the
+// file as a whole being half written.
+bool snapshot_save(const char *path, const TETRIS_SNAPSHOT *snap, bool sync);
+bool snapshot_load(const char *path, TETRIS_SNAPSHOT *snap);
+
+#endif
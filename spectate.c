@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "spectate.h"
+
+// STATIC RESOURCES
+static const char cell_chars[] = ".IOTSZJL";
+
+// HELPER FUNCTIONS
+static uint8_t cell_code(char c)
+{
+	const char *p = strchr(cell_chars, c);
+	return p && c ? p - cell_chars : 0;
+}
+
+static char cell_char(uint8_t code)
+{
+	return code < sizeof(cell_chars) - 1 ? cell_chars[code] : '.';
+}
+
+static void remove_rows(char *board, uint32_t mask)
+{
+	// Same shuffle as tetromino_clear_row.
+	int cleared = 0;
+	for (int row = 0; row < HEIGHT; row++) {
+		if (!(mask & (1u << row)))
+			continue;
+		memmove(board + WIDTH, board, row * WIDTH);
+		cleared++;
+	}
+	memset(board, '.', WIDTH * cleared);
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xFF;
+	return p + 2;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static bool pending_reserve(SPECTATE_ENCODER *enc, size_t len)
+{
+	// Falls back to a keyframe once the delta would not fit.
+	if (enc->want_keyframe)
+		return false;
+	if (enc->pending_len + len > SPECTATE_MAX_DELTA ||
+	    enc->pending_len + len >= SPECTATE_KEYFRAME_SIZE) {
+		enc->want_keyframe = true;
+		return false;
+	}
+	return true;
+}
+
+static SPECTATE_FRAME *frame_create(SPECTATE_ENCODER *enc, uint8_t type,
+				    size_t payload)
+{
+	SPECTATE_FRAME *frame = malloc(sizeof(SPECTATE_FRAME) +
+				       SPECTATE_HEADER + payload);
+	if (!frame)
+		return NULL;
+	atomic_init(&frame->refs, 1);
+	frame->len = SPECTATE_HEADER + payload;
+	frame->data[0] = type;
+	put16(frame->data + 1, enc->sequence++);
+	put16(frame->data + 3, payload);
+	return frame;
+}
+
+// FRAMES
+SPECTATE_FRAME *spectate_frame_ref(SPECTATE_FRAME *frame)
+{
+	atomic_fetch_add_explicit(&frame->refs, 1, memory_order_relaxed);
+	return frame;
+}
+
+void spectate_frame_unref(SPECTATE_FRAME *frame)
+{
+	if (frame && atomic_fetch_sub_explicit(&frame->refs, 1,
+					       memory_order_acq_rel) == 1)
+		free(frame);
+}
+
+// ENCODING
+void spectate_init(SPECTATE_ENCODER *enc)
+{
+	memset(enc, 0, sizeof(*enc));
+	enc->shadow.width = WIDTH;
+	enc->shadow.height = HEIGHT;
+	memset(enc->shadow.board, '.', WIDTH * HEIGHT);
+	enc->want_keyframe = true;
+}
+
+void spectate_request_keyframe(SPECTATE_ENCODER *enc)
+{
+	enc->want_keyframe = true;
+}
+
+void spectate_observe(SPECTATE_ENCODER *enc, const TETRIS_GAME *game, int events)
+{
+	// Call after anything that can lock a piece, so every cleared row mask is
+	// seen in order. Locked cells are whatever still differs afterwards.
+	if (events & EVENT_CLEAR) {
+		remove_rows(enc->shadow.board, game->clear_mask);
+		if (pending_reserve(enc, 5)) {
+			uint8_t *p = enc->pending + enc->pending_len;
+			p[0] = OP_ROWS;
+			put16(put16(p + 1, game->clear_mask >> 16), game->clear_mask);
+			enc->pending_len += 5;
+		}
+	}
+
+	if (!memcmp(enc->shadow.board, game->board, WIDTH * HEIGHT))
+		return;
+
+	int changed = 0;
+	for (int i = 0; i < WIDTH * HEIGHT; i++)
+		changed += enc->shadow.board[i] != game->board[i];
+
+	if (pending_reserve(enc, 2 + changed * 2)) {
+		uint8_t *p = enc->pending + enc->pending_len;
+		*p++ = OP_CELLS;
+		*p++ = changed;
+		for (int i = 0; i < WIDTH * HEIGHT; i++) {
+			if (enc->shadow.board[i] == game->board[i])
+				continue;
+			*p++ = i;
+			*p++ = cell_code(game->board[i]);
+		}
+		enc->pending_len = p - enc->pending;
+	}
+	memcpy(enc->shadow.board, game->board, WIDTH * HEIGHT);
+}
+
+static SPECTATE_FRAME *spectate_keyframe(SPECTATE_ENCODER *enc,
+					 const TETRIS_GAME *game, uint8_t status)
+{
+	SPECTATE_FRAME *frame = frame_create(enc, SPECTATE_KEYFRAME,
+					     SPECTATE_KEYFRAME_SIZE);
+	if (!frame)
+		return NULL;
+	uint8_t *p = frame->data + SPECTATE_HEADER;
+	*p++ = status;
+	p = put16(p, game->score);
+	p = put16(p, game->rows_cleared);
+	*p++ = game->level;
+	*p++ = game->tetromino_type;
+	*p++ = game->tetromino_rotation;
+	*p++ = (uint8_t)game->tetromino_x;
+	*p++ = (uint8_t)game->tetromino_y;
+	*p++ = game->bag_position;
+	memcpy(p, game->tetromino_bag, NUM_TETROMINO);
+	p += NUM_TETROMINO;
+	for (int i = 0; i < WIDTH * HEIGHT; i += 2)
+		*p++ = (cell_code(game->board[i]) << 4) |
+		       cell_code(game->board[i + 1]);
+
+	enc->shadow = *game;
+	enc->status = status;
+	enc->since_keyframe = 0;
+	enc->want_keyframe = false;
+	enc->pending_len = 0;
+	return frame;
+}
+
+SPECTATE_FRAME *spectate_flush(SPECTATE_ENCODER *enc, const TETRIS_GAME *game,
+			       uint8_t status)
+{
+	// Returns the frame to send to every spectator, or NULL if nothing
+	// changed since the last one.
+	TETRIS_GAME *shadow = &enc->shadow;
+	spectate_observe(enc, game, EVENT_NONE);
+
+	if (enc->since_keyframe >= SPECTATE_KEYFRAME_INTERVAL)
+		enc->want_keyframe = true;
+
+	if (status != enc->status && pending_reserve(enc, 2)) {
+		enc->pending[enc->pending_len++] = OP_STATUS;
+		enc->pending[enc->pending_len++] = status;
+		enc->status = status;
+	}
+	if ((game->score != shadow->score || game->level != shadow->level ||
+	     game->rows_cleared != shadow->rows_cleared) &&
+	    pending_reserve(enc, 6)) {
+		uint8_t *p = enc->pending + enc->pending_len;
+		*p++ = OP_SCORE;
+		p = put16(p, game->score);
+		p = put16(p, game->rows_cleared);
+		*p++ = game->level;
+		enc->pending_len = p - enc->pending;
+	}
+	if ((game->tetromino_type != shadow->tetromino_type ||
+	     game->tetromino_rotation != shadow->tetromino_rotation ||
+	     game->tetromino_x != shadow->tetromino_x ||
+	     game->tetromino_y != shadow->tetromino_y) &&
+	    pending_reserve(enc, 5)) {
+		uint8_t *p = enc->pending + enc->pending_len;
+		*p++ = OP_PIECE;
+		*p++ = game->tetromino_type;
+		*p++ = game->tetromino_rotation;
+		*p++ = (uint8_t)game->tetromino_x;
+		*p++ = (uint8_t)game->tetromino_y;
+		enc->pending_len = p - enc->pending;
+	}
+	if ((game->bag_position != shadow->bag_position ||
+	     memcmp(game->tetromino_bag, shadow->tetromino_bag, NUM_TETROMINO)) &&
+	    pending_reserve(enc, 2 + NUM_TETROMINO)) {
+		uint8_t *p = enc->pending + enc->pending_len;
+		*p++ = OP_BAG;
+		*p++ = game->bag_position;
+		memcpy(p, game->tetromino_bag, NUM_TETROMINO);
+		enc->pending_len += 2 + NUM_TETROMINO;
+	}
+
+	if (enc->want_keyframe)
+		return spectate_keyframe(enc, game, status);
+
+	if (!enc->pending_len)
+		return NULL;
+
+	SPECTATE_FRAME *frame = frame_create(enc, SPECTATE_DELTA, enc->pending_len);
+	if (!frame)
+		return NULL;
+	memcpy(frame->data + SPECTATE_HEADER, enc->pending, enc->pending_len);
+	enc->pending_len = 0;
+	enc->since_keyframe++;
+	// The board was already brought up to date by spectate_observe.
+	char board[WIDTH * HEIGHT];
+	memcpy(board, shadow->board, sizeof(board));
+	*shadow = *game;
+	memcpy(shadow->board, board, sizeof(board));
+	return frame;
+}
+
+// DECODING
+size_t spectate_frame_length(const uint8_t *data, size_t len)
+{
+	// Length of the frame at the start of a stream buffer, 0 if the header
+	// has not fully arrived yet.
+	if (len < SPECTATE_HEADER)
+		return 0;
+	return SPECTATE_HEADER + get16(data + 3);
+}
+
+static bool spectate_apply_delta(SPECTATE_DECODER *dec, const uint8_t *p,
+				 const uint8_t *end)
+{
+	TETRIS_GAME *game = &dec->game;
+	while (p < end) {
+		uint8_t op = *p++;
+		switch (op) {
+		case OP_STATUS:
+			if (end - p < 1)
+				return false;
+			dec->status = *p++;
+			break;
+		case OP_SCORE:
+			if (end - p < 5)
+				return false;
+			game->score = get16(p);
+			game->rows_cleared = get16(p + 2);
+			game->level = p[4];
+			p += 5;
+			break;
+		case OP_PIECE:
+			if (end - p < 4)
+				return false;
+			game->tetromino_type = p[0] % NUM_TETROMINO;
+			game->tetromino_rotation = p[1] % ROTATIONS;
+			game->tetromino_x = (int8_t)p[2];
+			game->tetromino_y = (int8_t)p[3];
+			p += 4;
+			break;
+		case OP_BAG:
+			if (end - p < 1 + NUM_TETROMINO)
+				return false;
+			game->bag_position = p[0];
+			for (int i = 0; i < NUM_TETROMINO; i++)
+				game->tetromino_bag[i] = p[1 + i] % NUM_TETROMINO;
+			p += 1 + NUM_TETROMINO;
+			break;
+		case OP_ROWS:
+			if (end - p < 4)
+				return false;
+			game->clear_mask = ((uint32_t)get16(p) << 16) | get16(p + 2);
+			remove_rows(game->board, game->clear_mask);
+			p += 4;
+			break;
+		case OP_CELLS: {
+			if (end - p < 1)
+				return false;
+			int count = *p++;
+			if (end - p < count * 2)
+				return false;
+			for (int i = 0; i < count; i++, p += 2)
+				if (p[0] < WIDTH * HEIGHT)
+					game->board[p[0]] = cell_char(p[1]);
+			break;
+		}
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+bool spectate_apply(SPECTATE_DECODER *dec, const uint8_t *data, size_t len)
+{
+	// Returns false when the frame cannot be applied, after which deltas
+	// are ignored until the next keyframe.
+	size_t frame_len = spectate_frame_length(data, len);
+	if (!frame_len || frame_len > len)
+		return false;
+
+	uint16_t sequence = get16(data + 1);
+	const uint8_t *p = data + SPECTATE_HEADER;
+	const uint8_t *end = data + frame_len;
+	if (data[0] == SPECTATE_KEYFRAME) {
+		if (frame_len != SPECTATE_HEADER + SPECTATE_KEYFRAME_SIZE)
+			return false;
+		TETRIS_GAME *game = &dec->game;
+		game->width = WIDTH;
+		game->height = HEIGHT;
+		dec->status = *p++;
+		game->score = get16(p);
+		game->rows_cleared = get16(p + 2);
+		game->level = p[4];
+		game->tetromino_type = p[5] % NUM_TETROMINO;
+		game->tetromino_rotation = p[6] % ROTATIONS;
+		game->tetromino_x = (int8_t)p[7];
+		game->tetromino_y = (int8_t)p[8];
+		game->bag_position = p[9];
+		p += 10;
+		for (int i = 0; i < NUM_TETROMINO; i++)
+			game->tetromino_bag[i] = p[i] % NUM_TETROMINO;
+		p += NUM_TETROMINO;
+		for (int i = 0; i < WIDTH * HEIGHT; i += 2, p++) {
+			game->board[i] = cell_char(*p >> 4);
+			game->board[i + 1] = cell_char(*p & 0xF);
+		}
+		dec->sequence = sequence;
+		dec->synced = true;
+		return true;
+	}
+
+	if (data[0] != SPECTATE_DELTA || !dec->synced ||
+	    sequence != (uint16_t)(dec->sequence + 1)) {
+		dec->synced = false;
+		return false;
+	}
+	dec->sequence = sequence;
+	if (!spectate_apply_delta(dec, p, end)) {
+		dec->synced = false;
+		return false;
+	}
+	return true;
+}
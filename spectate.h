@@ -0,0 +1,83 @@
+#ifndef SPECTATE_H
+#define SPECTATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "engine.h"
+
+// STREAM SETTINGS
+#define SPECTATE_KEYFRAME_INTERVAL 64
+#define SPECTATE_MAX_DELTA 256
+
+// FRAME LAYOUT
+// Every frame starts with its type, a sequence number and the payload length,
+// both big endian.
+#define SPECTATE_HEADER 5
+#define SPECTATE_KEYFRAME 'K'
+#define SPECTATE_DELTA 'D'
+
+// Streams carry the standard WIDTH x HEIGHT board, the only size the server
+// plays. Keyframe payload: status, score (2), rows cleared (2), level, piece type,
+// rotation, x, y, bag position, bag (7) and the board at four bits a cell.
+#define SPECTATE_KEYFRAME_SIZE (18 + (WIDTH * HEIGHT) / 2)
+
+// Delta payload is a list of these, applied in order.
+typedef enum SPECTATE_OP {
+	// status
+	OP_STATUS = 1,
+	// score (2), rows cleared (2), level
+	OP_SCORE,
+	// piece type, rotation, x, y
+	OP_PIECE,
+	// bag position, bag (7)
+	OP_BAG,
+	// row mask (4), as removed by tetromino_clear_row
+	OP_ROWS,
+	// count, then count pairs of cell index and cell value
+	OP_CELLS,
+} SPECTATE_OP;
+
+// An encoded frame shared by every spectator it is sent to.
+typedef struct SPECTATE_FRAME {
+	atomic_int refs;
+	uint16_t len;
+	uint8_t data[];
+} SPECTATE_FRAME;
+
+// What the spectators currently have, plus the changes not yet sent.
+typedef struct SPECTATE_ENCODER {
+	TETRIS_GAME shadow;
+	uint8_t status;
+	uint16_t sequence;
+	uint16_t since_keyframe;
+	bool want_keyframe;
+	uint16_t pending_len;
+	uint8_t pending[SPECTATE_MAX_DELTA];
+} SPECTATE_ENCODER;
+
+typedef struct SPECTATE_DECODER {
+	TETRIS_GAME game;
+	uint8_t status;
+	uint16_t sequence;
+	bool synced;
+} SPECTATE_DECODER;
+
+// FRAMES
+SPECTATE_FRAME *spectate_frame_ref(SPECTATE_FRAME *frame);
+void spectate_frame_unref(SPECTATE_FRAME *frame);
+
+// ENCODING
+void spectate_init(SPECTATE_ENCODER *enc);
+void spectate_request_keyframe(SPECTATE_ENCODER *enc);
+void spectate_observe(SPECTATE_ENCODER *enc, const TETRIS_GAME *game, int events);
+SPECTATE_FRAME *spectate_flush(SPECTATE_ENCODER *enc, const TETRIS_GAME *game,
+			       uint8_t status);
+
+// DECODING
+size_t spectate_frame_length(const uint8_t *data, size_t len);
+bool spectate_apply(SPECTATE_DECODER *dec, const uint8_t *data, size_t len);
+
+#endif
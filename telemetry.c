@@ -0,0 +1,454 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "telemetry.h"
+
+// Binary logs are the records as they are in memory.
+_Static_assert(sizeof(TELEMETRY_RECORD) == 52, "TELEMETRY_RECORD layout changed");
+
+// STRUCTURE AND DATA DEFINITIONS
+struct TELEMETRY_RING {
+	TELEMETRY_LOG *log;
+	struct TELEMETRY_RING *next;
+	// Single producer, single consumer: only the owning thread moves head
+	// and only the flush thread moves tail.
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+	// Records lost to a full ring
+	_Atomic uint32_t dropped;
+	uint32_t reported;
+	TELEMETRY_RECORD records[TELEMETRY_RING_SIZE];
+};
+
+struct TELEMETRY_LOG {
+	char *path;
+	FILE *file;
+	bool csv;
+	long bytes;
+	_Atomic uint32_t games;
+	// Guards the ring list and wakes the flush thread early to stop
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool stop;
+	TELEMETRY_RING *rings;
+	pthread_t thread;
+};
+
+static const char csv_header[] =
+	"kind,game,width,height,level,time,score,keys,finesse,piece,lines,"
+	"piece_ms,rest_ms,gravity_ms,pieces,singles,doubles,triples,tetrises,pps,kpp\n";
+
+// LOG FILE FUNCTIONS
+static bool log_open_file(TELEMETRY_LOG *log)
+{
+	// Appends to a log left by an earlier run, a new file gets a header.
+	log->file = fopen(log->path, log->csv ? "a" : "ab");
+	if (!log->file)
+		return false;
+	fseek(log->file, 0, SEEK_END);
+	log->bytes = ftell(log->file);
+	if (log->bytes > 0)
+		return true;
+	if (log->csv) {
+		fputs(csv_header, log->file);
+		log->bytes = sizeof(csv_header) - 1;
+	} else {
+		TELEMETRY_HEADER header = {
+			.magic = TELEMETRY_MAGIC,
+			.version = TELEMETRY_VERSION,
+			.record_size = sizeof(TELEMETRY_RECORD),
+		};
+		fwrite(&header, sizeof(header), 1, log->file);
+		log->bytes = sizeof(header);
+	}
+	return true;
+}
+
+static void log_rotate(TELEMETRY_LOG *log)
+{
+	// path becomes path.1, path.1 becomes path.2 and so on, the oldest
+	// falls off the end.
+	fclose(log->file);
+	size_t len = strlen(log->path) + 16;
+	char from[len];
+	char to[len];
+	for (int i = TELEMETRY_KEEP - 1; i > 0; i--) {
+		snprintf(from, len, "%s.%d", log->path, i);
+		snprintf(to, len, "%s.%d", log->path, i + 1);
+		rename(from, to);
+	}
+	snprintf(to, len, "%s.1", log->path);
+	rename(log->path, to);
+	if (!log_open_file(log))
+		fprintf(stderr, "telemetry: cannot reopen %s\n", log->path);
+}
+
+static void log_write(TELEMETRY_LOG *log, const TELEMETRY_RECORD *r)
+{
+	if (!log->csv) {
+		fwrite(r, sizeof(*r), 1, log->file);
+		log->bytes += sizeof(*r);
+		return;
+	}
+	int n;
+	if (r->kind == TELEMETRY_PIECE) {
+		n = fprintf(log->file, "piece,%u,%u,%u,%u,%u,%u,%u,%u,%c,%u,%u,%u,%u,,,,,,,\n",
+			    r->game, r->width, r->height, r->level, r->time, r->score,
+			    r->keys, r->finesse, "IOTSZJL"[r->piece % NUM_TETROMINO],
+			    r->lines, r->piece_ms, r->rest_ms, r->gravity_ms);
+	} else {
+		double seconds = r->time / 1000.0;
+		n = fprintf(log->file,
+			    "%s,%u,%u,%u,%u,%u,%u,%u,%u,,,,,,%u,%u,%u,%u,%u,%.3f,%.3f\n",
+			    r->kind == TELEMETRY_OVER ? "over" : "quit", r->game,
+			    r->width, r->height, r->level, r->time, r->score, r->keys,
+			    r->finesse, r->pieces, r->clears[0], r->clears[1],
+			    r->clears[2], r->clears[3],
+			    seconds > 0 ? r->pieces / seconds : 0.0,
+			    r->pieces ? (double)r->keys / r->pieces : 0.0);
+	}
+	if (n > 0)
+		log->bytes += n;
+}
+
+static void log_drain(TELEMETRY_LOG *log)
+{
+	// Called with the lock held, which only keeps new rings out.
+	for (TELEMETRY_RING *ring = log->rings; ring; ring = ring->next) {
+		uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		for (; tail != head; tail++) {
+			if (log->file)
+				log_write(log, &ring->records[tail & (TELEMETRY_RING_SIZE - 1)]);
+			if (log->file && log->bytes >= TELEMETRY_MAX_BYTES)
+				log_rotate(log);
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+		uint32_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+		if (dropped != ring->reported) {
+			fprintf(stderr, "telemetry: %u records dropped\n", dropped - ring->reported);
+			ring->reported = dropped;
+		}
+	}
+	if (log->file)
+		fflush(log->file);
+}
+
+static void *log_run(void *data)
+{
+	// All formatting and file writes happen here, never on a game thread.
+	TELEMETRY_LOG *log = data;
+	pthread_mutex_lock(&log->lock);
+	while (!log->stop) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += TELEMETRY_FLUSH_MS * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait(&log->wake, &log->lock, &ts);
+		log_drain(log);
+	}
+	pthread_mutex_unlock(&log->lock);
+	return NULL;
+}
+
+// LOG FUNCTIONS
+TELEMETRY_LOG *telemetry_open(const char *path)
+{
+	TELEMETRY_LOG *log = calloc(1, sizeof(*log));
+	if (!log)
+		return NULL;
+	size_t len = strlen(path);
+	log->path = malloc(len + 1);
+	if (!log->path) {
+		free(log);
+		return NULL;
+	}
+	memcpy(log->path, path, len + 1);
+	log->csv = len >= 4 && !strcmp(path + len - 4, ".csv");
+	atomic_init(&log->games, 1);
+	pthread_mutex_init(&log->lock, NULL);
+	pthread_cond_init(&log->wake, NULL);
+	if (!log_open_file(log) ||
+	    pthread_create(&log->thread, NULL, log_run, log) != 0) {
+		if (log->file)
+			fclose(log->file);
+		pthread_cond_destroy(&log->wake);
+		pthread_mutex_destroy(&log->lock);
+		free(log->path);
+		free(log);
+		return NULL;
+	}
+	return log;
+}
+
+TELEMETRY_RING *telemetry_ring(TELEMETRY_LOG *log)
+{
+	if (!log)
+		return NULL;
+	TELEMETRY_RING *ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+	ring->log = log;
+	pthread_mutex_lock(&log->lock);
+	ring->next = log->rings;
+	log->rings = ring;
+	pthread_mutex_unlock(&log->lock);
+	return ring;
+}
+
+bool telemetry_push(TELEMETRY_RING *ring, const TELEMETRY_RECORD *record)
+{
+	// Never waits: a lost record is better than a stalled frame.
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail == TELEMETRY_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return false;
+	}
+	ring->records[head & (TELEMETRY_RING_SIZE - 1)] = *record;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return true;
+}
+
+void telemetry_close(TELEMETRY_LOG *log)
+{
+	if (!log)
+		return;
+	pthread_mutex_lock(&log->lock);
+	log->stop = true;
+	pthread_cond_signal(&log->wake);
+	pthread_mutex_unlock(&log->lock);
+	pthread_join(log->thread, NULL);
+
+	log_drain(log);
+	if (log->file)
+		fclose(log->file);
+	while (log->rings) {
+		TELEMETRY_RING *next = log->rings->next;
+		free(log->rings);
+		log->rings = next;
+	}
+	pthread_cond_destroy(&log->wake);
+	pthread_mutex_destroy(&log->lock);
+	free(log->path);
+	free(log);
+}
+
+// PIECE FUNCTIONS
+static void piece_rows(uint8_t type, int rotation, int x, uint32_t rows[TETROMINO_WIDTH])
+{
+	// Cells the piece covers as a bit per column, one word per row.
+	memset(rows, 0, TETROMINO_WIDTH * sizeof(uint32_t));
+	for (int i = 0; i < TETROMINO_SIZE; i++) {
+		if (tetromino[type][i] == '.')
+			continue;
+		int index = tetromino_translate_rotation(i % TETROMINO_WIDTH, i / TETROMINO_WIDTH,
+							 type, rotation);
+		rows[index / TETROMINO_WIDTH] |=
+			1u << (x + TETROMINO_WIDTH + index % TETROMINO_WIDTH);
+	}
+}
+
+static void piece_reach(TELEMETRY_GAME *t, const TETRIS_GAME *game)
+{
+	// Breadth first over left, right and rotate at the spawn height, with
+	// the engine's own wall kicks. The board cannot change before the lock,
+	// so this is all finesse needs later. Runs once per piece.
+	enum { COLUMNS = MAX_WIDTH + TETROMINO_WIDTH * 2 };
+	TETRIS_GAME probe = *game;
+	uint8_t queue[ROTATIONS * COLUMNS][2];
+	int head = 0;
+	int count = 0;
+	memset(t->reach, 0xFF, sizeof(t->reach));
+	t->reach[game->tetromino_rotation][game->tetromino_x + TETROMINO_WIDTH] = 0;
+	queue[count][0] = game->tetromino_rotation;
+	queue[count++][1] = game->tetromino_x + TETROMINO_WIDTH;
+	while (head < count) {
+		int r = queue[head][0];
+		int x = queue[head++][1] - TETROMINO_WIDTH;
+		static const int moves[3][2] = { { 0, -1 }, { 0, 1 }, { 1, 0 } };
+		for (int m = 0; m < 3; m++) {
+			probe.tetromino_rotation = r;
+			probe.tetromino_x = x;
+			probe.tetromino_y = t->spawn_y;
+			if (!tetromino_move(&probe, (r + moves[m][0]) % ROTATIONS, x + moves[m][1],
+					    t->spawn_y))
+				continue;
+			uint8_t *reach = &t->reach[probe.tetromino_rotation]
+					 [probe.tetromino_x + TETROMINO_WIDTH];
+			if (*reach != 0xFF)
+				continue;
+			*reach = t->reach[r][x + TETROMINO_WIDTH] + 1;
+			queue[count][0] = probe.tetromino_rotation;
+			queue[count++][1] = probe.tetromino_x + TETROMINO_WIDTH;
+		}
+	}
+}
+
+static int piece_fewest_moves(const TELEMETRY_GAME *t)
+{
+	// Any column and rotation covering the same cells at the spawn height
+	// drops to the same place, which matters for I, S, Z and O. Returns -1
+	// for placements that took more than moving at the top, like tucks.
+	uint32_t target[TETROMINO_WIDTH];
+	uint32_t rows[TETROMINO_WIDTH];
+	piece_rows(t->piece, t->rotation, t->x, target);
+	int fewest = -1;
+	for (int r = 0; r < ROTATIONS; r++)
+		for (int c = 0; c < MAX_WIDTH + TETROMINO_WIDTH * 2; c++) {
+			int moves = t->reach[r][c];
+			if (moves == 0xFF || (fewest >= 0 && moves >= fewest))
+				continue;
+			piece_rows(t->piece, r, c - TETROMINO_WIDTH, rows);
+			if (!memcmp(rows, target, sizeof(rows)))
+				fewest = moves;
+		}
+	return fewest;
+}
+
+static void piece_track(TELEMETRY_GAME *t, const TETRIS_GAME *game, uint32_t now)
+{
+	// Where the piece is and since when it has been lying on the stack.
+	t->x = game->tetromino_x;
+	t->rotation = game->tetromino_rotation;
+	bool resting = tetromino_has_space(game, game->tetromino_rotation, game->tetromino_x,
+					   game->tetromino_y + 1) != 0;
+	if (resting && !t->resting)
+		t->landed = now;
+	t->resting = resting;
+}
+
+static void piece_spawn(TELEMETRY_GAME *t, const TETRIS_GAME *game, uint32_t now)
+{
+	t->spawn = now;
+	t->piece = game->tetromino_type;
+	t->spawn_y = game->tetromino_y;
+	t->keys = 0;
+	t->moves = 0;
+	int gravity = tetris_move_delay(game);
+	t->gravity = gravity > 0 ? gravity : 0;
+	t->resting = false;
+	piece_reach(t, game);
+	piece_track(t, game, now);
+}
+
+static void record_init(TELEMETRY_RECORD *r, const TELEMETRY_GAME *t, const TETRIS_GAME *game,
+			TELEMETRY_KIND kind, uint32_t now)
+{
+	memset(r, 0, sizeof(*r));
+	r->kind = kind;
+	r->width = game->width;
+	r->height = game->height;
+	r->level = game->level;
+	r->game = t->id;
+	r->score = game->score;
+	r->time = now - t->start;
+}
+
+// GAME FUNCTIONS
+void telemetry_game_start(TELEMETRY_GAME *t, TELEMETRY_RING *ring,
+			  const TETRIS_GAME *game, uint32_t now)
+{
+	if (!ring)
+		return;
+	memset(t, 0, sizeof(*t));
+	t->id = atomic_fetch_add_explicit(&ring->log->games, 1, memory_order_relaxed);
+	t->start = now;
+	piece_spawn(t, game, now);
+}
+
+void telemetry_key(TELEMETRY_GAME *t, TELEMETRY_RING *ring, const TETRIS_GAME *game,
+		   TELEMETRY_KEY key, uint32_t now)
+{
+	// Counted before the drop itself is passed to telemetry_events.
+	if (!ring || !t->id)
+		return;
+	t->keys++;
+	if (key != TELEMETRY_KEY_MOVE)
+		return;
+	t->moves++;
+	piece_track(t, game, now);
+}
+
+void telemetry_events(TELEMETRY_GAME *t, TELEMETRY_RING *ring, const TETRIS_GAME *game,
+		      int events, uint32_t now)
+{
+	if (!ring || !t->id)
+		return;
+	if (events & EVENT_GAME_OVER) {
+		telemetry_game_end(t, ring, game, TELEMETRY_OVER, now);
+		return;
+	}
+	if (!(events & EVENT_PLACE)) {
+		piece_track(t, game, now);
+		return;
+	}
+
+	// The clear mask is only written by a clear, see tetromino_clear_row.
+	int lines = 0;
+	if (events & EVENT_CLEAR)
+		for (uint64_t mask = game->clear_mask; mask; mask &= mask - 1)
+			lines++;
+	int fewest = piece_fewest_moves(t);
+	int finesse = fewest >= 0 && t->moves > fewest ? t->moves - fewest : 0;
+
+	TELEMETRY_RECORD r;
+	record_init(&r, t, game, TELEMETRY_PIECE, now);
+	r.keys = t->keys;
+	r.finesse = finesse;
+	r.piece = t->piece;
+	r.lines = lines;
+	r.piece_ms = now - t->spawn;
+	r.rest_ms = t->resting ? now - t->landed : 0;
+	r.gravity_ms = t->gravity;
+	telemetry_push(ring, &r);
+
+	t->pieces++;
+	t->total_keys += t->keys;
+	t->total_finesse += finesse;
+	if (lines > 0)
+		t->clears[(lines > 4 ? 4 : lines) - 1]++;
+	piece_spawn(t, game, now);
+}
+
+void telemetry_game_end(TELEMETRY_GAME *t, TELEMETRY_RING *ring, const TETRIS_GAME *game,
+			TELEMETRY_KIND kind, uint32_t now)
+{
+	if (!ring || !t->id)
+		return;
+	TELEMETRY_RECORD r;
+	record_init(&r, t, game, kind, t->paused_at ? t->paused_at : now);
+	r.keys = t->total_keys;
+	r.finesse = t->total_finesse;
+	r.pieces = t->pieces;
+	memcpy(r.clears, t->clears, sizeof(r.clears));
+	telemetry_push(ring, &r);
+	// Nothing more is recorded until the next start.
+	t->id = 0;
+}
+
+void telemetry_pause(TELEMETRY_GAME *t, TELEMETRY_RING *ring, uint32_t now)
+{
+	if (ring)
+		t->paused_at = now;
+}
+
+void telemetry_resume(TELEMETRY_GAME *t, TELEMETRY_RING *ring, uint32_t now)
+{
+	// Shift every timestamp so the pause never happened.
+	if (!ring || !t->paused_at)
+		return;
+	uint32_t paused = now - t->paused_at;
+	t->start += paused;
+	t->spawn += paused;
+	t->landed += paused;
+	t->paused_at = 0;
+}
@@ -0,0 +1,120 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "engine.h"
+
+// TELEMETRY SETTINGS
+// Records each producing thread can have in flight, must be a power of two
+#define TELEMETRY_RING_SIZE 1024
+// How often the background thread writes out what has been pushed
+#define TELEMETRY_FLUSH_MS 200
+// Logs are rotated past this size, keeping this many old ones
+#define TELEMETRY_MAX_BYTES (64L << 20)
+#define TELEMETRY_KEEP 4
+
+#define TELEMETRY_MAGIC 0x4C455454u
+#define TELEMETRY_VERSION 1
+
+typedef enum TELEMETRY_KIND {
+	TELEMETRY_PIECE = 1,
+	// Game summaries, for a top out or a game left unfinished
+	TELEMETRY_OVER,
+	TELEMETRY_QUIT,
+} TELEMETRY_KIND;
+
+typedef enum TELEMETRY_KEY {
+	// Left, right and rotate: what finesse is judged on
+	TELEMETRY_KEY_MOVE,
+	// Soft and fast drops
+	TELEMETRY_KEY_DROP,
+} TELEMETRY_KEY;
+
+// One line of the log, written as is in binary logs.
+typedef struct TELEMETRY_RECORD {
+	uint8_t kind;
+	uint8_t width;
+	uint8_t height;
+	uint8_t level;
+	uint32_t game;
+	// Game time in ms of the lock, or the length of the game
+	uint32_t time;
+	uint32_t score;
+	// Inputs that did something, and moves beyond the fewest that reach
+	// the same placement
+	uint32_t keys;
+	uint32_t finesse;
+	// Pieces: type, rows cleared, ms from spawn to lock, ms resting on the
+	// stack before the lock and the gravity interval it fell at
+	uint8_t piece;
+	uint8_t lines;
+	uint16_t padding;
+	uint32_t piece_ms;
+	uint32_t rest_ms;
+	uint32_t gravity_ms;
+	// Games: pieces placed and clears by number of rows
+	uint32_t pieces;
+	uint16_t clears[4];
+} TELEMETRY_RECORD;
+
+// Start of a binary log, followed by whole records.
+typedef struct TELEMETRY_HEADER {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+} TELEMETRY_HEADER;
+
+typedef struct TELEMETRY_LOG TELEMETRY_LOG;
+typedef struct TELEMETRY_RING TELEMETRY_RING;
+
+// Metrics of the game in progress, fed by the thread playing it.
+typedef struct TELEMETRY_GAME {
+	uint32_t id;
+	uint32_t start;
+	uint32_t paused_at;
+	// Current piece
+	uint32_t spawn;
+	uint32_t landed;
+	bool resting;
+	uint8_t piece;
+	int8_t x;
+	uint8_t rotation;
+	int8_t spawn_y;
+	uint16_t keys;
+	uint16_t moves;
+	uint16_t gravity;
+	// Fewest moves to each column and rotation from the spawn, 0xFF where
+	// it cannot be reached.
+	uint8_t reach[ROTATIONS][MAX_WIDTH + TETROMINO_WIDTH * 2];
+	// Totals
+	uint32_t pieces;
+	uint32_t total_keys;
+	uint32_t total_finesse;
+	uint16_t clears[4];
+} TELEMETRY_GAME;
+
+// Logs ending in .csv are text, anything else is binary. Returns NULL if
+// the file or the thread cannot be created.
+TELEMETRY_LOG *telemetry_open(const char *path);
+// Every thread that pushes records needs its own ring.
+TELEMETRY_RING *telemetry_ring(TELEMETRY_LOG *log);
+bool telemetry_push(TELEMETRY_RING *ring, const TELEMETRY_RECORD *record);
+// Writes out everything pushed so far, the producers must have stopped.
+void telemetry_close(TELEMETRY_LOG *log);
+
+// Metrics for one game, all free when ring is NULL. Times are game ms.
+void telemetry_game_start(TELEMETRY_GAME *t, TELEMETRY_RING *ring,
+			  const TETRIS_GAME *game, uint32_t now);
+void telemetry_key(TELEMETRY_GAME *t, TELEMETRY_RING *ring, const TETRIS_GAME *game,
+		   TELEMETRY_KEY key, uint32_t now);
+void telemetry_events(TELEMETRY_GAME *t, TELEMETRY_RING *ring, const TETRIS_GAME *game,
+		      int events, uint32_t now);
+void telemetry_game_end(TELEMETRY_GAME *t, TELEMETRY_RING *ring, const TETRIS_GAME *game,
+			TELEMETRY_KIND kind, uint32_t now);
+// Only needed where the time passed in keeps running during a pause.
+void telemetry_pause(TELEMETRY_GAME *t, TELEMETRY_RING *ring, uint32_t now);
+void telemetry_resume(TELEMETRY_GAME *t, TELEMETRY_RING *ring, uint32_t now);
+
+#endif
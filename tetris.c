@@ -11,11 +11,12 @@
 #include <math.h>
 
 #include <SDL2/SDL.h>
-#include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
 
-#include "font.h"
-#include "tiles.h"
+#include "tetris.h"
+#include "engine.h"
+#include "replay.h"
+#include "snapshot.h"
 
 #ifdef MUSIC
 #include <SDL2/SDL_mixer.h>
@@ -29,149 +30,24 @@
 #endif
 
 // DISPLAY SETTINGS
-#define WINDOW_TITLE "Tetris"
-#define DESIRED_HEIGHT 720
-
 #define MAX_FPS (1000 / 144)
+// Nothing due, sleep until there is input
+#define WAIT_FOREVER UINT32_MAX
 
+// SAVE SETTINGS
+#define SAVE_FILE "tetris.sav"
 
-// PLAY GRID DIMENSIONS
-#define WIDTH 10
-#define HEIGHT 20
-
-// ADD SPACE FOR BOARDER AND UI
-#define LEFT_OFFSET 5
-#define RIGHT_OFFSET 1
-#define TOP_OFFSET 1
-#define BOTTOM_OFFSET 1
-// HORIZONTAL OFFSET
-#define UI_OFFSET 3
-
-// LOGICAL SIZE OF A TETRIS SQUARE
-#define SQUARE_DIM (DESIRED_HEIGHT / (HEIGHT + TOP_OFFSET + BOTTOM_OFFSET))
-
-// Smooth the boarders
-#define WINDOW_HEIGHT (SQUARE_DIM * (HEIGHT + TOP_OFFSET + BOTTOM_OFFSET))
-#define WINDOW_WIDTH (SQUARE_DIM * (WIDTH + LEFT_OFFSET + RIGHT_OFFSET))
-
-// NUMBER OF CHARACTERS PER TETROMINO
-#define TETROMINO_WIDTH 4
-#define TETROMINO_SIZE 16
-
-// GAMEPLAY MODIFIERS
-#define MOVE_DELAY 1000
-#define MIN_MOVE_DELAY 25
-#define ROTATION_DELAY 100
-#define DIFFICULTY_RATIO 0.1
-
-// STRUCTURE AND DATA DEFINITIONS
-typedef enum TETROMINO {
-	I,
-	O,
-	T,
-	S,
-	Z,
-	J,
-	L,
-	NUM_TETROMINO,
-} TETROMINO;
-
-typedef enum ROTATION {
-	DEG_0,
-	DEG_90,
-	DEG_180,
-	DEG_270,
-	ROTATIONS,
-} ROTATION;
-
-typedef enum GAME_STATUS {
-	MENU,
-	PLAYING,
-	PAUSED,
-	GAME_OVER,
-	CLOSING,
-} GAME_STATUS;
-
-typedef struct TETRIS_STATE {
-	// Rendering stuff
-	SDL_Window *window;
-	SDL_Renderer *renderer;
-	TTF_Font *font;
-	SDL_Texture *tiles;
-#ifdef MUSIC
-	// Sounds and music
-	Mix_Music *theme;
-	Mix_Chunk *move;
-	Mix_Chunk *place;
-	Mix_Chunk *clear;
-	Mix_Chunk *over;
-	Mix_Chunk *level_up;
-#endif
-	// Game status
-	GAME_STATUS status;
-	// Timing
-	uint32_t start_time;
-	uint32_t pause_time;
-	uint32_t pause_start;
-	uint32_t last_frame;
-	uint32_t last_move;
-	uint32_t last_rotate;
-	uint32_t last_ui;
-	// Score
-	uint16_t score;
-	uint16_t rows_cleared;
-	uint8_t level;
-	// Board
-	char board[(WIDTH * HEIGHT) * 2];
-	// Tetris Tetromino bag
-	TETROMINO tetromino_bag[NUM_TETROMINO];
-	uint8_t bag_position;
-	// Current piece
-	TETROMINO tetromino_type;
-	int tetromino_x;
-	int tetromino_y;
-	ROTATION tetromino_rotation;
-} TETRIS_STATE;
+// WALL SETTINGS
+#define MAX_WATCH 256
 
 // FUNCTION PROTOTYPES
-static void draw_border(TETRIS_STATE *tetris);
-static void draw_ui(TETRIS_STATE *tetris);
-static void draw_bag(TETRIS_STATE *tetris);
-static void draw_placed(TETRIS_STATE *tetris);
-static void draw_piece(TETRIS_STATE *tetris);
 static void reset_tetris_state(TETRIS_STATE *tetris);
-
-// STATIC RESOURCES
-const char *tetromino[NUM_TETROMINO] = {
-	"..I."
-	"..I."
-	"..I."
-	"..I.",
-	".OO."
-	".OO."
-	"...."
-	"....",
-	"..T."
-	".TTT"
-	"...."
-	"....",
-	"..SS"
-	".SS."
-	"...."
-	"....",
-	".ZZ."
-	"..ZZ"
-	"...."
-	"....",
-	".J.."
-	".JJJ"
-	"...."
-	"....",
-	"...L"
-	".LLL"
-	"...."
-	"....",
-};
+#ifdef MUSIC
+static void start_theme(TETRIS_STATE *tetris);
+static bool sound_ready(TETRIS_STATE *tetris);
+#endif
+static void tetris_save(TETRIS_STATE *tetris, bool sync);
+static void tetris_save_replay(TETRIS_STATE *tetris);
 
 // TIMING FUNCTIONS
 static uint32_t tetris_get_time(TETRIS_STATE *tetris)
@@ -183,9 +59,13 @@ static void tetris_pause(TETRIS_STATE *tetris)
 {
 	tetris->pause_start = SDL_GetTicks();
 	tetris->status = PAUSED;
+	tetris->dirty = true;
 #ifdef MUSIC
+	// Effects are short, cut rather than held over the pause.
 	Mix_PauseMusic();
+	sfx_stop(&tetris->sfx);
 #endif
+	tetris_save(tetris, true);
 }
 
 static void tetris_unpause(TETRIS_STATE *tetris)
@@ -193,745 +73,420 @@ static void tetris_unpause(TETRIS_STATE *tetris)
 	uint32_t pausediff = SDL_GetTicks() - tetris->pause_start;
 	tetris->pause_time += pausediff;
 	tetris->status = PLAYING;
+	tetris->dirty = true;
 #ifdef MUSIC
 	Mix_ResumeMusic();
 #endif
 }
 
-// HELPER FUNCTIONS
-static int tetromino_translate_rotation(int x, int y, TETROMINO t,
-					ROTATION rotation)
+// SAVE FUNCTIONS
+static void tetris_save(TETRIS_STATE *tetris, bool sync)
 {
-	// Disable O rotation.
-	if (t == O)
-		return y * TETROMINO_WIDTH + x;
-
-	switch (rotation % ROTATIONS) {
-	case DEG_0:
-		return y * TETROMINO_WIDTH + x;
-	case DEG_90:
-		return 12 + y - (x * TETROMINO_WIDTH);
-	case DEG_180:
-		return 15 - (y * TETROMINO_WIDTH) - x;
-	case DEG_270:
-		return 3 - y + (x * TETROMINO_WIDTH);
-	}
-	return y * TETROMINO_WIDTH + x;
-}
-
-static void tetromino_create_bag(TETRIS_STATE *tetris)
-{
-	static const TETROMINO start_bag[NUM_TETROMINO] = { I, O, T, S, Z, J, L };
-	memcpy(tetris->tetromino_bag, start_bag, sizeof(TETROMINO) * NUM_TETROMINO);
-	for (size_t i = I; i < NUM_TETROMINO; i++) {
-		size_t j = i + rand() / (RAND_MAX / (NUM_TETROMINO - i) + 1);
-		TETROMINO t = tetris->tetromino_bag[j];
-		tetris->tetromino_bag[j] = tetris->tetromino_bag[i];
-		tetris->tetromino_bag[i] = t;
-	}
-	tetris->bag_position = 0;
-	draw_bag(tetris);
-}
-
-static int tetromino_has_space(TETRIS_STATE *tetris, ROTATION r, int x, int y)
-{
-	// Check next location.
-	// Returns 1 for out of bounds, 2 for block placement and 3 for game over.
-	for (int i = 0; i < TETROMINO_SIZE; i++) {
-		// Skip empty spaces
-		if (tetromino[tetris->tetromino_type][i] == '.')
-			continue;
-
-		// Get rotation indexes if rotated
-		int rotatedIndex =
-			tetromino_translate_rotation(i % TETROMINO_WIDTH,
-						     i / TETROMINO_WIDTH,
-						     tetris->tetromino_type, r);
-
-		// Add the indexes to the top left corner to get the actual position
-		int real_x = x + (rotatedIndex % TETROMINO_WIDTH);
-		int real_y = y + (rotatedIndex / TETROMINO_WIDTH);
-
-		// Check the x axis bounds
-		if (real_x < 0 || real_x >= WIDTH)
-			return 1;
-
-		// Check if we have hit the bottom
-		if (real_y == HEIGHT)
-			return 2;
-
-		// Off the screen, cannot be a game over
-		if (real_y < 0)
-			continue;
-
-		// Check for game over or block placement
-		// Check space that we are moving to is empty
-		if (tetris->board[real_x + (real_y * WIDTH)] != '.') {
-			// Block on top.
-			if (real_y <= 0)
-				return 3;
-
-			return 2;
-		}
-	}
-	return 0;
-}
-
-static bool tetromino_move(TETRIS_STATE *tetris, ROTATION r, int x, int y)
-{
-	// Checks if new state is possible, writes if so otherwise does nothing.
-	// Checks and allows for wall kicks
-	// Check with original movement attempt.
-	if (tetromino_has_space(tetris, r, x, y) == 0) {
-		// Can move! write new position.
-		tetris->tetromino_rotation = r;
-		tetris->tetromino_x = x;
-		tetris->tetromino_y = y;
-		return true;
-	}
-	// WALL KICKS
-	// Check if there is a free space to the right.
-	if (tetromino_has_space(tetris, r, x + 1, y) == 0) {
-		tetris->tetromino_rotation = r;
-		tetris->tetromino_x = x + 1;
-		tetris->tetromino_y = y;
-		return true;
-	}
-	// Check if there is a free space to the left.
-	if (tetromino_has_space(tetris, r, x - 1, y) == 0) {
-		tetris->tetromino_rotation = r;
-		tetris->tetromino_x = x - 1;
-		tetris->tetromino_y = y;
-		return true;
-	}
-	// FLOOR KICKS // DO WE NEED IT?
-	return false;
-}
-
-static void tetromino_init(TETRIS_STATE *tetris)
-{
-	tetris->tetromino_type = tetris->tetromino_bag[tetris->bag_position];
-	tetris->bag_position++;
-	if (tetris->bag_position >= NUM_TETROMINO)
-		tetromino_create_bag(tetris);
-
-	tetris->tetromino_x = (WIDTH / 2) - (TETROMINO_WIDTH / 2);
-	tetris->tetromino_y = -TETROMINO_WIDTH;
-	tetris->tetromino_rotation = DEG_0;
-	for (int i = 0; i < TETROMINO_WIDTH; i++) {
-		if (tetromino_has_space(tetris, tetris->tetromino_rotation,
-					tetris->tetromino_x,
-					tetris->tetromino_y + 1) != 0)
-			break;
-		tetris->tetromino_y++;
-	}
-}
-
-static void tetromino_write(TETRIS_STATE *tetris)
-{
-	// Convert tetromino x and y to actual board coordinates
-	for (int i = 0; i < TETROMINO_SIZE; i++) {
-		if (tetromino[tetris->tetromino_type][i] == '.')
-			continue;
-
-		// Get the x and y inside of the tetromino
-		int sub_x = i % TETROMINO_WIDTH;
-		int sub_y = i / TETROMINO_WIDTH;
-
-		// Get the rotated index
-		int true_index =
-			tetromino_translate_rotation(sub_x, sub_y, tetris->tetromino_type,
-						     tetris->tetromino_rotation);
-
-		int true_x = true_index % TETROMINO_WIDTH;
-		int true_y = true_index / TETROMINO_WIDTH;
-
-		// Write to the board
-		// Index translation.
-		int index = tetris->tetromino_x + true_x + ((tetris->tetromino_y + true_y) * WIDTH);
-
-		tetris->board[index] =
-			tetromino[tetris->tetromino_type][i];
-	}
+	TETRIS_SNAPSHOT snap;
+	snapshot_init(&snap);
+	snap.status = tetris->status;
+	// Game time stands still while paused.
+	if (tetris->status == PAUSED)
+		snap.elapsed = tetris->pause_start - tetris->start_time - tetris->pause_time;
+	else
+		snap.elapsed = tetris_get_time(tetris);
+	snap.last_move = tetris->last_move;
+	snap.last_rotate = tetris->last_rotate;
+	snap.last_ui = tetris->last_ui;
+	snap.game = tetris->game;
+	snapshot_save(SAVE_FILE, &snap, sync);
 }
 
-static int tetromino_drop_location(TETRIS_STATE *tetris)
+static bool tetris_resume(TETRIS_STATE *tetris)
 {
-	int y = tetris->tetromino_y;
-	int space = -1;
-	while (true) {
-		space = tetromino_has_space(tetris, tetris->tetromino_rotation,
-					    tetris->tetromino_x, y + 1);
-		if (space == 2 || space == 3)
-			return y;
+	// Pick up a saved game where it left off, paused until the player is
+	// ready.
+	TETRIS_SNAPSHOT snap;
+	if (!snapshot_load(SAVE_FILE, &snap) ||
+	    (snap.status != PLAYING && snap.status != PAUSED))
+		return false;
 
-		y++;
-	}
-	return -1;
+	tetris->game = snap.game;
+	uint32_t now = SDL_GetTicks();
+	tetris->start_time = now - snap.elapsed;
+	tetris->pause_time = 0;
+	tetris->last_frame = snap.elapsed;
+	tetris->last_move = snap.last_move;
+	tetris->last_rotate = snap.last_rotate;
+	tetris->last_ui = snap.last_ui;
+	telemetry_game_start(&tetris->telemetry_game, tetris->telemetry, &tetris->game,
+			     snap.elapsed);
+	// Replays start from a seed, there is no way to start one mid game.
+	if (tetris->replay_path)
+		SDL_Log("Resumed a saved game, %s will be recorded from the next new game",
+			tetris->replay_path);
+#ifdef MUSIC
+	start_theme(tetris);
+#endif
+	tetris_pause(tetris);
+	return true;
 }
 
-// RENDER FUNCTIONS
-static SDL_Rect transform_coords(int x, int y)
+// REPLAY FUNCTIONS
+static void tetris_record(TETRIS_STATE *tetris, REPLAY_OP op)
 {
-	return (SDL_Rect){
-		       .x = (x + LEFT_OFFSET) * SQUARE_DIM,
-		       .y = WINDOW_HEIGHT - (HEIGHT - y + 1) * SQUARE_DIM,
-		       .w = SQUARE_DIM,
-		       .h = SQUARE_DIM,
-	};
+	if (!tetris->replay_path || !tetris->replay.header.magic)
+		return;
+	replay_record(&tetris->replay, tetris->replay_offset + tetris_get_time(tetris), op);
 }
 
-static void draw_tile(SDL_Renderer *renderer, SDL_Rect dst_rect, SDL_Texture *tex, char c)
+static void tetris_start_recording(TETRIS_STATE *tetris)
 {
-	int index = -1;
-	switch (c) {
-	case 0:
-		index = 0;
-		break;
-	case 'I':
-		index = 1;
-		break;
-	case 'O':
-		index = 2;
-		break;
-	case 'T':
-		index = 3;
-		break;
-	case 'S':
-		index = 4;
-		break;
-	case 'Z':
-		index = 5;
-		break;
-	case 'J':
-		index = 6;
-		break;
-	case 'L':
-		index = 7;
-		break;
-	default:
+	// Called just before a new game. The first one records the seed, later
+	// ones continue the same replay so the random state carries over.
+	if (!tetris->replay_path)
+		return;
+	if (!tetris->replay.header.magic) {
+		replay_init(&tetris->replay, tetris->game.rng, tetris->game.width,
+			    tetris->game.height);
 		return;
 	}
-	SDL_Rect src_rect = { index * 32, 0, 32, 32 };
-	SDL_RenderCopy(renderer, tex, &src_rect, &dst_rect);
+	tetris_record(tetris, REPLAY_RESET);
+	// Keep replay time running across games.
+	tetris->replay_offset += tetris_get_time(tetris);
 }
 
-static void draw_ghost_tile(TETRIS_STATE *tetris, int x, int y)
+static void tetris_save_replay(TETRIS_STATE *tetris)
 {
-	SDL_Rect dst_rect = transform_coords(x, y);
-	SDL_SetRenderDrawColor(tetris->renderer, 255, 255, 255, 125);
-	SDL_RenderDrawRect(tetris->renderer, &dst_rect);
-	SDL_SetRenderDrawColor(tetris->renderer, 0, 0, 0, 255);
-}
-
-static void draw_tetromino_tile(TETRIS_STATE *tetris, char t, int x, int y)
-{
-	SDL_Rect dst_rect = transform_coords(x, y);
-	draw_tile(tetris->renderer, dst_rect, tetris->tiles, t);
+	if (tetris->replay_path && tetris->replay.header.magic)
+		replay_save(tetris->replay_path, &tetris->replay);
 }
 
-static void draw_tetromino_preview_tile(TETRIS_STATE *tetris, TETROMINO t,
-					int x, int y)
+// TELEMETRY FUNCTIONS
+static void tetris_key(TETRIS_STATE *tetris, TELEMETRY_KEY key)
 {
-	// Position of the top left quad
-	SDL_Rect start_rect = transform_coords(x, y);
-	start_rect.w = SQUARE_DIM / 2;
-	start_rect.h = SQUARE_DIM / 2;
-	for (int i = 0; i < TETROMINO_SIZE; i++) {
-		int sub_x = i % TETROMINO_WIDTH;
-		int sub_y = i / TETROMINO_WIDTH;
-		SDL_Rect dst_rect = start_rect;
-		dst_rect.x += (SQUARE_DIM / 2) * sub_x;
-		dst_rect.y += (SQUARE_DIM / 2) * sub_y;
-		char c = tetromino[t][i];
-		draw_tile(tetris->renderer, dst_rect, tetris->tiles, c);
-	}
+	// Inputs that did something. Counted once they have, but before their
+	// events reach telemetry_events, so a drop belongs to the piece it placed.
+	telemetry_key(&tetris->telemetry_game, tetris->telemetry, &tetris->game, key,
+		      tetris_get_time(tetris));
 }
 
-static void draw_font(SDL_Renderer *renderer, TTF_Font *font, int x, int y,
-		      const char *str)
-{
-	static SDL_Color c = { 255, 255, 255, 255 };
-	SDL_Surface *surface = TTF_RenderText_Solid(font, str, c);
-	SDL_Rect pos = {
-		.x = SQUARE_DIM * (x + 1) + 2,
-		.y = (surface->h * y) + (TOP_OFFSET * SQUARE_DIM),
-	};
-	pos.w = surface->w;
-	pos.h = surface->h;
-	SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-	SDL_FreeSurface(surface);
-	SDL_RenderCopy(renderer, texture, NULL, &pos);
-	SDL_DestroyTexture(texture);
-}
+// CORE LOOP FUNCTIONS
 
-static void tetromino_clear_row(TETRIS_STATE *tetris)
+static void play_events(TETRIS_STATE *tetris, const TETRIS_GAME *before, int events)
 {
-	// Check all the rows
-	int cleared_rows[HEIGHT] = { 0 };
-	int cleared = 0;
-	for (int row = 0; row < HEIGHT; row++)
-		for (int col = 0; col < WIDTH; col++) {
-			if (tetris->board[(row * WIDTH) + col] == '.')
-				break;
-			if (col == WIDTH - 1) {
-				cleared_rows[row] = 1;
-				cleared++;
-			}
-		}
-
-	// No rows cleared.
-	if (!cleared)
-		return;
-
+	// Sounds, effects and redraws for whatever the engine just did.
 #ifdef MUSIC
-	Mix_PlayChannel(-1, tetris->clear, 0);
-#endif
-	// // Animate the row destruction. // Blocks game loop lol.
-	// uint32_t start_animation = SDL_GetTicks();
-	// while (SDL_GetTicks() < start_animation + 500)
-	// {
-	//     for (int row = 0; row < HEIGHT; row++)
-	//     {
-	//         if (!cleared_rows[row])
-	//             continue;
-	//         for (int col = 0; col < WIDTH; col++)
-	//         {
-	//             SDL_Rect rect = transform_coords(col, row);
-	//             uint32_t passed = SDL_GetTicks() - start_animation;
-	//             int opacity = (500 - passed) / 255;
-	//             draw_rect(tetris->renderer, rect, (SDL_Color){0, 0, 0, opacity}, true);
-	//         }
-	//     }
-	//     SDL_RenderPresent(tetris->renderer);
-	// }
-
-	// Remove the rows
-	for (int row = 0; row < HEIGHT; row++) {
-		if (!cleared_rows[row])
-			continue;
-		memmove(tetris->board + WIDTH, tetris->board, row * WIDTH);
-	}
-	// Initialize the top row
-	memset(tetris->board, '.', WIDTH * cleared);
-
-	// Add the score!
-	switch (cleared) {
-	case 1:
-		tetris->score += 40 * (tetris->level + 1);
-		tetris->rows_cleared += cleared;
-		break;
-	case 2:
-		tetris->score += 100 * (tetris->level + 1);
-		tetris->rows_cleared += cleared;
-		break;
-	case 3:
-		tetris->score += 300 * (tetris->level + 1);
-		tetris->rows_cleared += cleared;
-		break;
-	default:
-		tetris->score += 1200 * (tetris->level + 1);
-		tetris->rows_cleared += cleared * 2;
-		break;
+	if (sound_ready(tetris)) {
+		if (events & EVENT_PLACE)
+			sfx_play(&tetris->sfx, SFX_PLACE);
+		if (events & EVENT_CLEAR)
+			sfx_play(&tetris->sfx, SFX_CLEAR);
+		if (events & EVENT_LEVEL_UP)
+			sfx_play(&tetris->sfx, SFX_LEVEL_UP);
 	}
-	// New level?
-	int level;
-	if (tetris->level < 10)
-		level = tetris->rows_cleared / 10;
-	else if (tetris->level < 20)
-		level = tetris->rows_cleared / 15;
-	else if (tetris->level < 30)
-		level = tetris->rows_cleared / 20;
-	else
-		level = tetris->rows_cleared / 25;
-
-	if (level > tetris->level) {
-		tetris->level = level;
-#ifdef MUSIC
-		Mix_PlayChannel(-1, tetris->level_up, 0);
 #endif
-	}
-}
-
-// RENDER PRESETS
-
-static void draw_border(TETRIS_STATE *tetris)
-{
-	// Draw board box
-	// Vertical barriers
-	for (int i = 0; i < HEIGHT; i++) {
-		draw_tetromino_tile(tetris, 0, -LEFT_OFFSET, i); // LEFT EDGE
-		draw_tetromino_tile(tetris, 0, WIDTH, i); // RIGHT EDGE
-		draw_tetromino_tile(tetris, 0, -1, i);   // UI EDGE
-	}
-	// Horizontal barriers
-	for (int i = 0 - LEFT_OFFSET; i < WIDTH + LEFT_OFFSET + RIGHT_OFFSET; i++) {
-		draw_tetromino_tile(tetris, 0, i, HEIGHT); // TOP
-		draw_tetromino_tile(tetris, 0, i, -1); // BOTTOM
-		if (i < 0)
-			draw_tetromino_tile(tetris, 0, i, UI_OFFSET); // UI SEPERATOR
-	}
-}
-
-static void draw_ui(TETRIS_STATE *tetris)
-{
-	const SDL_Rect viewport = {
-		.x = (1) * SQUARE_DIM,
-		.y = (1) * SQUARE_DIM,
-		.w = (LEFT_OFFSET - 2) * SQUARE_DIM,
-		.h = (UI_OFFSET)*SQUARE_DIM,
-	};
-	SDL_RenderFillRect(tetris->renderer, &viewport);
-
-	// Draw score, level and time
-	char time[] = "Time:           ";
-	uint32_t timestamp = tetris_get_time(tetris);
-	uint16_t mins = timestamp / 1000 / 60;
-	uint16_t secs = (timestamp / 1000) % 60;
-	sprintf(time + 6, " %.2u: %.2u", mins, secs);
-	draw_font(tetris->renderer, tetris->font, 0, 0, time);
-	char level[] = "Level:           ";
-	sprintf(level + 7, " %u", tetris->level);
-	draw_font(tetris->renderer, tetris->font, 0, 1, level);
-	char score[] = "Score:";
-	draw_font(tetris->renderer, tetris->font, 0, 2, score);
-	char points[9];
-	sprintf(points, "%.8d", tetris->score);
-	draw_font(tetris->renderer, tetris->font, 0, 3, points);
+	telemetry_events(&tetris->telemetry_game, tetris->telemetry, &tetris->game, events,
+			 tetris_get_time(tetris));
+	animate_events(tetris, before, events, tetris_get_time(tetris));
+	// Kept current with every piece so a power cut loses little, but only
+	// synced once nobody is playing, that stalls a frame on slow storage.
+	if (events & EVENT_PLACE)
+		tetris_save(tetris, false);
+	tetris->dirty = true;
 }
 
-static void draw_bag(TETRIS_STATE *tetris)
-{
-	// Clear the bag location
-	const SDL_Rect viewport = {
-		.x = (1) * SQUARE_DIM,
-		.y = (UI_OFFSET + 2) * SQUARE_DIM,
-		.w = (LEFT_OFFSET - 2) * SQUARE_DIM,
-		.h = (HEIGHT - UI_OFFSET - 1) * SQUARE_DIM,
-	};
-	SDL_RenderFillRect(tetris->renderer, &viewport);
-
-	// Starting grid in the large grid sizes
-	int x = 1 - LEFT_OFFSET;
-	int y = UI_OFFSET + 1;
-	// Draw each preview tetromino
-	for (int p = tetris->bag_position; p < NUM_TETROMINO; p++) {
-		int position = p - tetris->bag_position;
-		TETROMINO t = tetris->tetromino_bag[p];
-		int new_y = y + (position * TETROMINO_WIDTH / 2);
-		// We dont want to write out of our section
-		if (new_y + (TETROMINO_WIDTH / 2) > WIDTH * 2)
-			break;
-
-		draw_tetromino_preview_tile(tetris, t, x, new_y);
-	}
-}
-
-static void draw_placed(TETRIS_STATE *tetris)
-{
-	// Draw board state
-	for (int i = 0; i < (WIDTH * HEIGHT) * 2; i++) {
-		draw_tetromino_tile(tetris, tetris->board[i], (i % WIDTH), (i / (HEIGHT / 2)));
-	}
-}
-
-static void draw_piece(TETRIS_STATE *tetris)
-{
-	int drop_y = tetromino_drop_location(tetris);
-	// Draw falling piece
-	for (int i = 0; i < TETROMINO_SIZE; i++) {
-		// Skip empty spaces
-		if (tetromino[tetris->tetromino_type][i] == '.')
-			continue;
-
-		int sub_x = i % TETROMINO_WIDTH;
-		int sub_y = i / TETROMINO_WIDTH;
-		int rotatedIndex =
-			tetromino_translate_rotation(sub_x, sub_y,
-						     tetris->tetromino_type,
-						     tetris->tetromino_rotation);
-		sub_x = rotatedIndex % TETROMINO_WIDTH;
-		sub_y = rotatedIndex / TETROMINO_WIDTH;
-
-		// No rendering when we overlap.
-		if (drop_y + sub_y >= 0 && drop_y + sub_y != tetris->tetromino_y + sub_y)
-			draw_ghost_tile(tetris,
-					tetris->tetromino_x + sub_x,
-					drop_y + sub_y);
-
-		if (tetris->tetromino_y + sub_y >= 0)
-			draw_tetromino_tile(tetris, tetromino[tetris->tetromino_type][i],
-					    tetris->tetromino_x + sub_x,
-					    tetris->tetromino_y + sub_y);
-	}
-}
-
-static void draw_board(TETRIS_STATE *tetris)
-{
-	const SDL_Rect viewport = {
-		.x = (LEFT_OFFSET)*SQUARE_DIM,
-		.y = 1 * SQUARE_DIM,
-		.w = WIDTH * SQUARE_DIM,
-		.h = HEIGHT * SQUARE_DIM,
-	};
-	SDL_RenderFillRect(tetris->renderer, &viewport);
-	draw_placed(tetris);
-	draw_piece(tetris);
-}
-
-// CORE LOOP FUNCTIONS
-
-static void update_state(TETRIS_STATE *tetris)
+static void update_state(TETRIS_STATE *tetris, bool soft_drop)
 {
 	// Are we writing the tetromino and creating a new one?
 	if (tetris->last_move + MIN_MOVE_DELAY >= tetris_get_time(tetris) &&
-	    tetris->tetromino_y < 0)
+	    tetris->game.tetromino_y < 0)
 		return;
 
 	tetris->last_move = tetris_get_time(tetris);
-
-	int move_status = tetromino_has_space(tetris, tetris->tetromino_rotation, tetris->tetromino_x,
-					      tetris->tetromino_y + 1);
-	if (move_status == 2) {
-#ifdef MUSIC
-		Mix_PlayChannel(-1, tetris->place, 0);
-#endif
-		tetromino_write(tetris);
-		tetromino_clear_row(tetris);
-		tetromino_init(tetris);
-		draw_bag(tetris);
-		draw_board(tetris);
-		return;
-	}
-
-	if (move_status == 3) {
+	// The soft drop key only counts when it stepped the piece.
+	if (soft_drop)
+		tetris_key(tetris, TELEMETRY_KEY_DROP);
+
+	tetris_record(tetris, REPLAY_STEP);
+	TETRIS_GAME before = tetris->game;
+	int events = tetris_game_step(&tetris->game);
+	if (events & EVENT_GAME_OVER) {
+		telemetry_events(&tetris->telemetry_game, tetris->telemetry, &tetris->game,
+				 events, tetris_get_time(tetris));
 		tetris->status = GAME_OVER;
+		remove(SAVE_FILE);
+		tetris_save_replay(tetris);
 #ifdef MUSIC
 		Mix_HaltMusic();
-		Mix_PlayChannel(-1, tetris->over, 0);
+		tetris->theme_pending = false;
+		if (sound_ready(tetris))
+			sfx_play(&tetris->sfx, SFX_OVER);
 #endif
-		char *game_over = "Game over! Press enter to play again";
-		TTF_Font *big = TTF_OpenFontRW(SDL_RWFromConstMem(res_font_otf, res_font_otf_len),
-					       1, SQUARE_DIM);
-		static SDL_Color c = { 255, 255, 255, 255 };
-		SDL_Surface *surface = TTF_RenderText_Solid(big, game_over, c);
-		TTF_CloseFont(big);
-		SDL_Rect pos = {
-			.x = WINDOW_WIDTH / 2 - (surface->w / 2),
-			.y = WINDOW_HEIGHT / 2,
-			.w = surface->w,
-			.h = surface->h,
-		};
-		SDL_RenderFillRect(tetris->renderer, &pos);
-		SDL_Texture *texture = SDL_CreateTextureFromSurface(tetris->renderer, surface);
-		SDL_FreeSurface(surface);
-		SDL_RenderCopy(tetris->renderer, texture, NULL, &pos);
-		SDL_DestroyTexture(texture);
+		tetris->dirty = true;
 		return;
 	}
 
-	// Update the move timer.
-	tetris->tetromino_y++;
-	draw_board(tetris);
+	play_events(tetris, &before, events);
 }
 
 static void fast_drop(TETRIS_STATE *tetris)
 {
 	if (tetris->last_move + MIN_MOVE_DELAY >= tetris_get_time(tetris))
 		return;
-	int drop_y = tetromino_drop_location(tetris);
 
-	if (drop_y == -1)
+	TETRIS_GAME before = tetris->game;
+	int events = tetris_game_fast_drop(&tetris->game);
+	if (events == EVENT_NONE)
 		return;
 
-	tetris->tetromino_y = drop_y;
+	tetris_record(tetris, REPLAY_DROP);
+	tetris_key(tetris, TELEMETRY_KEY_DROP);
 	tetris->last_move = tetris_get_time(tetris);
-#ifdef MUSIC
-	Mix_PlayChannel(-1, tetris->place, 0);
-#endif
-	tetromino_write(tetris);
-	tetromino_clear_row(tetris);
-	tetromino_init(tetris);
-	draw_bag(tetris);
-	draw_board(tetris);
+	play_events(tetris, &before, events);
 }
 
-static void handle_events(TETRIS_STATE *tetris)
+static void handle_event(TETRIS_STATE *tetris, const SDL_Event *event)
 {
-	static SDL_Event event;
 #ifdef MUSIC
 	static bool muted;
 #endif
-	while (SDL_PollEvent(&event)) {
-		switch (event.type) {
-		case SDL_QUIT:
-			tetris->status = CLOSING;
-			break;
-		case SDL_KEYDOWN:
+	switch (event->type) {
+	case SDL_QUIT:
+		// Pausing saves the game for next time.
+		if (tetris->status == PLAYING)
+			tetris_pause(tetris);
+		if (tetris->status == PAUSED)
+			telemetry_game_end(&tetris->telemetry_game, tetris->telemetry,
+					   &tetris->game, TELEMETRY_QUIT,
+					   tetris->pause_start - tetris->start_time -
+					   tetris->pause_time);
+		tetris->status = CLOSING;
+		break;
+	case SDL_WINDOWEVENT:
+		// Whatever was on screen may be gone.
+		tetris->dirty = true;
+		// Synced like a pause, the player has looked away.
+		if (event->window.event == SDL_WINDOWEVENT_FOCUS_LOST && tetris->status == PLAYING)
+			tetris_save(tetris, true);
+		break;
+	case SDL_KEYDOWN:
 #ifdef MUSIC
-			if (event.key.keysym.scancode == SDL_SCANCODE_M) {
-				if (muted) {
-					Mix_VolumeMusic(VOLUME_DEFAULT);
-					Mix_Volume(-1, VOLUME_DEFAULT * 1.5);
-				}else {
-					Mix_VolumeMusic(0);
-					Mix_Volume(-1, 0);
-				}
-				muted = !muted;
+		if (event->key.keysym.scancode == SDL_SCANCODE_M) {
+			if (muted) {
+				Mix_VolumeMusic(VOLUME_DEFAULT);
+				sfx_volume(&tetris->sfx, VOLUME_DEFAULT * 1.5);
+			}else {
+				Mix_VolumeMusic(0);
+				sfx_volume(&tetris->sfx, 0);
 			}
+			muted = !muted;
+		}
 #endif
-			if (tetris->status == GAME_OVER) {
-				switch (event.key.keysym.scancode) {
-				case SDL_SCANCODE_RETURN:
-					reset_tetris_state(tetris);
-					tetris->status = PLAYING;
-					break;
-				default:
-					break;
-				}
+		if (tetris->status == GAME_OVER) {
+			switch (event->key.keysym.scancode) {
+			case SDL_SCANCODE_RETURN:
+				reset_tetris_state(tetris);
+				tetris->status = PLAYING;
 				break;
-			}
-			if (tetris->status == PAUSED) {
-				switch (event.key.keysym.scancode) {
-				case SDL_SCANCODE_P:
-				case SDL_SCANCODE_ESCAPE:
-					tetris_unpause(tetris);
-					break;
-				default:
-					break;
-				}
+			default:
 				break;
 			}
-			switch (event.key.keysym.scancode) {
-			// Move left and right
-			case SDL_SCANCODE_A:
-			case SDL_SCANCODE_LEFT:
-				if (tetromino_move(tetris, tetris->tetromino_rotation,
-						   tetris->tetromino_x - 1, tetris->tetromino_y))
-					draw_board(tetris);
-				break;
-			case SDL_SCANCODE_D:
-			case SDL_SCANCODE_RIGHT:
-				if (tetromino_move(tetris, tetris->tetromino_rotation,
-						   tetris->tetromino_x + 1, tetris->tetromino_y))
-					draw_board(tetris);
-				break;
-			// Move down one unit (trigger a state update early)
-			case SDL_SCANCODE_W:
-			case SDL_SCANCODE_UP:
-				if (tetris_get_time(tetris) <= tetris->last_rotate + ROTATION_DELAY)
-					break;
-				if (tetromino_move(tetris,
-						   (tetris->tetromino_rotation + 1) % ROTATIONS,
-						   tetris->tetromino_x, tetris->tetromino_y)) {
-					draw_board(tetris);
-					tetris->last_rotate = tetris_get_time(tetris);
-				}
-				break;
-			// Rotate
-			case SDL_SCANCODE_S:
-			case SDL_SCANCODE_DOWN:
-				update_state(tetris);
-				break;
-			// Pause
+			break;
+		}
+		if (tetris->status == PAUSED) {
+			switch (event->key.keysym.scancode) {
 			case SDL_SCANCODE_P:
 			case SDL_SCANCODE_ESCAPE:
-				tetris_pause(tetris);
+				tetris_unpause(tetris);
 				break;
-			// Fast drop
-			case SDL_SCANCODE_SPACE:
-				fast_drop(tetris);
 			default:
 				break;
 			}
+			break;
+		}
+		switch (event->key.keysym.scancode) {
+		// Move left and right
+		case SDL_SCANCODE_A:
+		case SDL_SCANCODE_LEFT:
+			if (tetromino_move(&tetris->game, tetris->game.tetromino_rotation,
+					   tetris->game.tetromino_x - 1, tetris->game.tetromino_y)) {
+				tetris_record(tetris, REPLAY_LEFT);
+				tetris_key(tetris, TELEMETRY_KEY_MOVE);
+				tetris->dirty = true;
+			}
+			break;
+		case SDL_SCANCODE_D:
+		case SDL_SCANCODE_RIGHT:
+			if (tetromino_move(&tetris->game, tetris->game.tetromino_rotation,
+					   tetris->game.tetromino_x + 1, tetris->game.tetromino_y)) {
+				tetris_record(tetris, REPLAY_RIGHT);
+				tetris_key(tetris, TELEMETRY_KEY_MOVE);
+				tetris->dirty = true;
+			}
+			break;
+		// Move down one unit (trigger a state update early)
+		case SDL_SCANCODE_W:
+		case SDL_SCANCODE_UP:
+			if (tetris_get_time(tetris) <= tetris->last_rotate + ROTATION_DELAY)
+				break;
+			if (tetromino_move(&tetris->game,
+					   (tetris->game.tetromino_rotation + 1) % ROTATIONS,
+					   tetris->game.tetromino_x, tetris->game.tetromino_y)) {
+				tetris_record(tetris, REPLAY_ROTATE);
+				tetris_key(tetris, TELEMETRY_KEY_MOVE);
+				tetris->dirty = true;
+				tetris->last_rotate = tetris_get_time(tetris);
+			}
+			break;
+		// Rotate
+		case SDL_SCANCODE_S:
+		case SDL_SCANCODE_DOWN:
+			update_state(tetris, true);
+			break;
+		// Pause
+		case SDL_SCANCODE_P:
+		case SDL_SCANCODE_ESCAPE:
+			tetris_pause(tetris);
+			break;
+		// Fast drop
+		case SDL_SCANCODE_SPACE:
+			fast_drop(tetris);
 		default:
 			break;
 		}
+	default:
+		break;
+	}
+}
+
+static void handle_events(TETRIS_STATE *tetris, uint32_t timeout)
+{
+	// Sleep until input arrives or the next thing is due, then take
+	// everything that is queued.
+	SDL_Event event;
+	int got;
+	if (timeout == 0)
+		got = SDL_PollEvent(&event);
+	else if (timeout == WAIT_FOREVER)
+		got = SDL_WaitEvent(&event);
+	else
+		got = SDL_WaitEventTimeout(&event, timeout);
+	while (got) {
+		handle_event(tetris, &event);
+		got = SDL_PollEvent(&event);
 	}
 }
 
 // INITIALIZATION FUNCTIONS
 static void init_rendering(TETRIS_STATE *tetris)
 {
+	// Sized for the game about to be shown, which may be a resumed one.
+	TETRIS_LAYOUT *layout = &tetris->layout;
+	render_layout(layout, tetris->game.width, tetris->game.height);
 	tetris->window =
 		SDL_CreateWindow(WINDOW_TITLE,
 				 SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-				 WINDOW_WIDTH, WINDOW_HEIGHT, 0);
+				 layout->window_width, layout->window_height, 0);
 	tetris->renderer = SDL_CreateRenderer(tetris->window, -1,
 					      SDL_RENDERER_ACCELERATED);
 	SDL_SetRenderDrawColor(tetris->renderer, 0, 0, 0, 255);
-	SDL_RenderSetLogicalSize(tetris->renderer, WINDOW_WIDTH, WINDOW_HEIGHT);
+	SDL_RenderSetLogicalSize(tetris->renderer, layout->window_width,
+				 layout->window_height);
 	SDL_SetRenderDrawBlendMode(tetris->renderer, SDL_BLENDMODE_BLEND);
-	tetris->font =
-		TTF_OpenFontRW(SDL_RWFromConstMem(res_font_otf, res_font_otf_len),
-			       1, (WINDOW_HEIGHT / SQUARE_DIM) * 0.75);
-	tetris->tiles = IMG_LoadTexture_RW(tetris->renderer,
-					   SDL_RWFromConstMem(res_tiles_png, res_tiles_png_len), 0);
+	render_load_assets(tetris);
 }
 
 static void free_rendering(TETRIS_STATE *tetris)
 {
-	TTF_CloseFont(tetris->font);
-	SDL_DestroyTexture(tetris->tiles);
+	render_free_assets(tetris);
 	SDL_DestroyRenderer(tetris->renderer);
 	SDL_DestroyWindow(tetris->window);
 }
 
 #ifdef MUSIC
+static int load_sound(void *data)
+{
+	TETRIS_STATE *tetris = data;
+	tetris->theme = Mix_LoadMUS_RW(SDL_RWFromConstMem(res_theme_mp3, res_theme_mp3_len), -1);
+	// Effects are converted to the device format here, playing one is
+	// then just a copy in the audio callback.
+	sfx_load(&tetris->sfx, SFX_PLACE, SDL_RWFromConstMem(res_fall_wav, res_fall_wav_len));
+	sfx_load(&tetris->sfx, SFX_CLEAR, SDL_RWFromConstMem(res_clear_wav, res_clear_wav_len));
+	sfx_load(&tetris->sfx, SFX_OVER, SDL_RWFromConstMem(res_over_wav, res_over_wav_len));
+	sfx_load(&tetris->sfx, SFX_LEVEL_UP, SDL_RWFromConstMem(res_level_wav, res_level_wav_len));
+	SDL_AtomicSet(&tetris->sound_loaded, 1);
+	// Wake the main loop in case it sleeps, the theme may be waiting.
+	SDL_Event event = { .type = SDL_USEREVENT };
+	SDL_PushEvent(&event);
+	return 0;
+}
+
+static bool sound_ready(TETRIS_STATE *tetris)
+{
+	return SDL_AtomicGet(&tetris->sound_loaded);
+}
+
+static void start_theme(TETRIS_STATE *tetris)
+{
+	// Played from game_loop once loading is done if it is not ready yet.
+	tetris->theme_pending = !sound_ready(tetris);
+	if (tetris->theme_pending)
+		return;
+	Mix_PlayMusic(tetris->theme, -1);
+	if (tetris->status == PAUSED)
+		Mix_PauseMusic();
+}
+
 static void init_sound(TETRIS_STATE *tetris)
 {
 	Mix_VolumeMusic(VOLUME_DEFAULT);
-	Mix_Volume(-1, VOLUME_DEFAULT * 1.5);
-	tetris->theme = Mix_LoadMUS_RW(SDL_RWFromConstMem(res_theme_mp3, res_theme_mp3_len), -1);
-	tetris->place = Mix_LoadWAV_RW(SDL_RWFromConstMem(res_fall_wav, res_fall_wav_len), -1);
-	tetris->clear = Mix_LoadWAV_RW(SDL_RWFromConstMem(res_clear_wav, res_clear_wav_len), -1);
-	tetris->over = Mix_LoadWAV_RW(SDL_RWFromConstMem(res_over_wav, res_over_wav_len), -1);
-	tetris->level_up = Mix_LoadWAV_RW(SDL_RWFromConstMem(res_level_wav, res_level_wav_len), -1);
+	// Without the device the game runs silent: effects are not converted
+	// for it and what is queued is never mixed.
+	if (!sfx_open(&tetris->sfx))
+		SDL_Log("No low latency audio device: %s", SDL_GetError());
+	sfx_volume(&tetris->sfx, VOLUME_DEFAULT * 1.5);
+	// Decoding is the slowest part of startup, so it runs next to the first
+	// frames. Sounds are skipped until it is done.
+	tetris->sound_thread = SDL_CreateThread(load_sound, "sound", tetris);
+	if (!tetris->sound_thread)
+		load_sound(tetris);
 }
 
 static void free_sound(TETRIS_STATE *tetris)
 {
+	SDL_WaitThread(tetris->sound_thread, NULL);
 	Mix_FreeMusic(tetris->theme);
-	Mix_FreeChunk(tetris->place);
-	Mix_FreeChunk(tetris->clear);
-	Mix_FreeChunk(tetris->over);
-	Mix_FreeChunk(tetris->level_up);
+	sfx_close(&tetris->sfx);
 }
 #endif
 
 static void reset_tetris_state(TETRIS_STATE *tetris)
 {
-	memset(tetris->board, '.', (WIDTH * HEIGHT) * 2);
-	tetris->level = 0;
-	tetris->rows_cleared = 0;
-	tetris->score = 0;
-	tetromino_create_bag(tetris);
-	tetromino_init(tetris);
-	tetris->tetromino_y = 0;
+	tetris_start_recording(tetris);
+	// Carry the random state over into the next game.
+	tetris_game_reset(&tetris->game, tetris->game.rng);
+	anim_clear(&tetris->anims);
 	tetris->status = PLAYING;
 #ifdef MUSIC
-	Mix_PlayMusic(tetris->theme, -1);
+	start_theme(tetris);
 #endif
 	// Initialize the timers.
 	uint32_t now = SDL_GetTicks();
 	tetris->start_time = now;
 	tetris->pause_time = 0;
 	tetris->pause_start = 0;
-	tetris->last_frame = now;
+	tetris->last_frame = 0;
 	tetris->last_move = 0;
 	tetris->last_rotate = 0;
 	tetris->last_ui = 0;
-	// Draw the boarder
-	draw_border(tetris);
-	draw_board(tetris);
-	draw_ui(tetris);
-	draw_bag(tetris);
+	tetris->dirty = true;
+	telemetry_game_start(&tetris->telemetry_game, tetris->telemetry, &tetris->game, 0);
 }
 
 static void init_tetris_state(TETRIS_STATE *tetris)
 {
 	tetris->status = PLAYING;
-	reset_tetris_state(tetris);
+	if (!tetris_resume(tetris)) {
+		reset_tetris_state(tetris);
+		return;
+	}
+	tetris->dirty = true;
 }
 
 static bool init_modules(void)
@@ -943,6 +498,8 @@ static bool init_modules(void)
 		return false;
 
 #ifdef MUSIC
+	// Music only, the large buffer is fine for it. Effects use their own
+	// device, see sfx.h.
 	if (Mix_OpenAudio(22050, MIX_DEFAULT_FORMAT, 2, 4096) == -1)
 		return false;
 #endif
@@ -959,25 +516,83 @@ static void quit_modules(void)
 	SDL_Quit();
 }
 
+static uint32_t next_wakeup(TETRIS_STATE *tetris)
+{
+	// How long nothing changes on screen without input: until the next
+	// animation frame, gravity step or clock second, or forever when paused
+	// or over. Input always wakes us straight away.
+	uint32_t now = tetris_get_time(tetris);
+	// At most one frame every MAX_FPS, which also keeps gravity at high
+	// levels to one step a frame.
+	uint32_t due = tetris->last_frame + MAX_FPS;
+	if (!anim_active(&tetris->anims)) {
+		if (tetris->status != PLAYING)
+			return WAIT_FOREVER;
+
+		uint32_t gravity = tetris->last_move + tetris_move_delay(&tetris->game) + 1;
+		// update_state holds off a little on pieces still above the board.
+		if (tetris->game.tetromino_y < 0 &&
+		    (int32_t)(gravity - (tetris->last_move + MIN_MOVE_DELAY + 1)) < 0)
+			gravity = tetris->last_move + MIN_MOVE_DELAY + 1;
+		uint32_t tick = (tetris->last_ui / 1000 + 1) * 1000;
+		uint32_t next = (int32_t)(gravity - tick) < 0 ? gravity : tick;
+		if ((int32_t)(next - due) > 0)
+			due = next;
+	}
+	return (int32_t)(due - now) > 0 ? due - now : 0;
+}
+
+static void render_frame(TETRIS_STATE *tetris)
+{
+	// Everything is redrawn, what was presented before is undefined.
+	uint32_t now = tetris_get_time(tetris);
+	SDL_RenderClear(tetris->renderer);
+	draw_border(tetris);
+	draw_board(tetris);
+	draw_ui(tetris, tetris->last_ui);
+	draw_bag(tetris);
+	if (tetris->status == GAME_OVER)
+		draw_game_over(tetris);
+	draw_animations(tetris, now);
+	SDL_RenderPresent(tetris->renderer);
+	tetris->dirty = false;
+
+	if (tetris->startup) {
+		double ms = (SDL_GetPerformanceCounter() - tetris->startup) * 1000.0 /
+			    SDL_GetPerformanceFrequency();
+		tetris->startup = 0;
+		if (tetris->startup_report) {
+			printf("First frame after %.1f ms\n", ms);
+			tetris->status = CLOSING;
+		}
+	}
+}
+
 static void game_loop(void *data)
 {
 	TETRIS_STATE *tetris = data;
+#ifdef WASM
+	// The browser calls us once per frame and we must not block it.
+	handle_events(tetris, 0);
+#else
+	handle_events(tetris, next_wakeup(tetris));
+#endif
+#ifdef MUSIC
+	if (tetris->theme_pending && sound_ready(tetris) &&
+	    (tetris->status == PLAYING || tetris->status == PAUSED))
+		start_theme(tetris);
+#endif
 	uint32_t this_frame = tetris_get_time(tetris);
-	draw_border(tetris);
-	draw_board(tetris);
-	draw_ui(tetris);
-	handle_events(tetris);
 	switch (tetris->status) {
 	case PLAYING:
-		if (tetris->last_move + MOVE_DELAY -
-		    (int)(MOVE_DELAY * (DIFFICULTY_RATIO * tetris->level)) <
-		    this_frame)
-			update_state(tetris);
-
-		if (tetris->last_ui + 1000 < tetris_get_time(tetris)) {
-			draw_ui(tetris);
-			tetris->last_ui = tetris_get_time(tetris);
-		}
+		if ((int32_t)(tetris->last_move + tetris_move_delay(&tetris->game) - this_frame) < 0)
+			update_state(tetris, false);
+
+		// The clock only shows whole seconds.
+		if (this_frame / 1000 != tetris->last_ui / 1000)
+			tetris->dirty = true;
+		if (tetris->status == PLAYING)
+			tetris->last_ui = this_frame;
 		break;
 	case PAUSED:
 		break;
@@ -986,15 +601,100 @@ static void game_loop(void *data)
 	default:
 		break;
 	}
-	SDL_RenderPresent(tetris->renderer);
-	this_frame = tetris_get_time(tetris);
-	if (tetris->last_frame > this_frame - MAX_FPS)
-		SDL_Delay(tetris->last_frame + MAX_FPS - this_frame);
+	if (!tetris->dirty && !anim_active(&tetris->anims))
+		return;
+
+	render_frame(tetris);
 	tetris->last_frame = tetris_get_time(tetris);
 }
 
+static int usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [--board WxH] [--record FILE] [--telemetry FILE] [--startup-time]\n"
+		"       %s --export REPLAY OUT [--threads N] [--fps N]\n"
+		"       %s --wall N [--board WxH] [--watch-port N --watch ID ...] [--seconds N]\n",
+		name, name, name);
+	return 1;
+}
+
 int main(int argc, char *argv[])
 {
+	// Startup is timed from here to the first frame on screen.
+	uint64_t startup = SDL_GetPerformanceCounter();
+	bool startup_report = false;
+	const char *record = NULL;
+	const char *telemetry = NULL;
+	const char *export_in = NULL;
+	const char *export_out = NULL;
+	int threads = 0;
+	int fps = 60;
+	int width = WIDTH;
+	int height = HEIGHT;
+	bool wall = false;
+	int wall_local = 0;
+	int watch_port = 0;
+	uint32_t watch[MAX_WATCH];
+	int nwatch = 0;
+	int seconds = 0;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+			record = argv[++i];
+		} else if (!strcmp(argv[i], "--telemetry") && i + 1 < argc) {
+			telemetry = argv[++i];
+		} else if (!strcmp(argv[i], "--export") && i + 2 < argc) {
+			export_in = argv[++i];
+			export_out = argv[++i];
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+			fps = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--board") && i + 1 < argc) {
+			if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 ||
+			    !tetris_board_size_valid(width, height)) {
+				fprintf(stderr, "Boards go from %dx%d to %dx%d\n",
+					MIN_WIDTH, MIN_HEIGHT, MAX_WIDTH, MAX_HEIGHT);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--wall") && i + 1 < argc) {
+			wall = true;
+			wall_local = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--watch-port") && i + 1 < argc) {
+			watch_port = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--watch") && i + 1 < argc && nwatch < MAX_WATCH) {
+			wall = true;
+			watch[nwatch++] = strtoul(argv[++i], NULL, 0);
+		} else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+			seconds = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--startup-time")) {
+			startup_report = true;
+		} else {
+			return usage(argv[0]);
+		}
+	}
+
+	if (export_in) {
+		// Offscreen only, no window or audio device needed.
+		if (SDL_Init(0) < 0 || TTF_Init() < 0)
+			return 1;
+		int ret = export_replay(export_in, export_out, threads, fps);
+		TTF_Quit();
+		SDL_Quit();
+		return ret;
+	}
+
+	if (wall) {
+		if (wall_local < 0 || wall_local + nwatch == 0 || (nwatch && !watch_port))
+			return usage(argv[0]);
+		if (SDL_Init(SDL_INIT_VIDEO) < 0 || TTF_Init() < 0)
+			return 1;
+		int ret = wall_run(wall_local, width, height, watch_port, watch, nwatch,
+				   seconds);
+		TTF_Quit();
+		SDL_Quit();
+		return ret;
+	}
+
 	if (!init_modules()) {
 		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,
 					 "Fatal Error",
@@ -1002,14 +702,26 @@ int main(int argc, char *argv[])
 					 NULL);
 		return 1;
 	}
-	srand(time(NULL));
-
 	TETRIS_STATE tetris = { 0 };
-	init_rendering(&tetris);
+	tetris.game.rng = time(NULL);
+	// New games keep the size, a resumed game brings its own.
+	tetris.game.width = width;
+	tetris.game.height = height;
+	tetris.replay_path = record;
+	tetris.startup = startup;
+	tetris.startup_report = startup_report;
+	TELEMETRY_LOG *telemetry_log = NULL;
+	if (telemetry) {
+		telemetry_log = telemetry_open(telemetry);
+		if (!telemetry_log)
+			SDL_Log("Cannot write telemetry to %s", telemetry);
+		tetris.telemetry = telemetry_ring(telemetry_log);
+	}
 #ifdef MUSIC
 	init_sound(&tetris);
 #endif
 	init_tetris_state(&tetris);
+	init_rendering(&tetris);
 
 #ifdef WASM
 	emscripten_set_main_loop_arg(&game_loop, &tetris, -1, 1);
@@ -1018,6 +730,9 @@ int main(int argc, char *argv[])
 		game_loop(&tetris);
 #endif
 
+	tetris_save_replay(&tetris);
+	replay_free(&tetris.replay);
+	telemetry_close(telemetry_log);
 #ifdef MUSIC
 	free_sound(&tetris);
 #endif
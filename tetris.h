@@ -0,0 +1,126 @@
+#ifndef TETRIS_H
+#define TETRIS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#ifdef MUSIC
+#include <SDL2/SDL_mixer.h>
+#include "sfx.h"
+#endif
+
+#include "engine.h"
+#include "replay.h"
+#include "anim.h"
+#include "telemetry.h"
+
+// DISPLAY SETTINGS
+#define WINDOW_TITLE "Tetris"
+#define DESIRED_HEIGHT 720
+
+// ADD SPACE FOR BOARDER AND UI
+#define LEFT_OFFSET 5
+#define RIGHT_OFFSET 1
+#define TOP_OFFSET 1
+#define BOTTOM_OFFSET 1
+// HORIZONTAL OFFSET
+#define UI_OFFSET 3
+
+// ANIMATION SETTINGS
+#define LOCK_FLASH_MS 150
+#define CLEAR_FADE_MS 400
+#define LEVEL_UP_MS 800
+
+// STRUCTURE AND DATA DEFINITIONS
+typedef enum GAME_STATUS {
+	MENU,
+	PLAYING,
+	PAUSED,
+	GAME_OVER,
+	CLOSING,
+} GAME_STATUS;
+
+// Screen geometry for a board size, see render_layout.
+typedef struct TETRIS_LAYOUT {
+	// Board size in cells
+	int width;
+	int height;
+	// Logical size of a tetris square
+	int square;
+	int window_width;
+	int window_height;
+	int font_size;
+	int big_font_size;
+} TETRIS_LAYOUT;
+
+typedef struct TETRIS_STATE {
+	// Rendering stuff
+	TETRIS_LAYOUT layout;
+	SDL_Window *window;
+	SDL_Renderer *renderer;
+	TTF_Font *font;
+	TTF_Font *big_font;
+	SDL_Texture *tiles;
+#ifdef MUSIC
+	// Sounds and music
+	Mix_Music *theme;
+	SFX_MIXER sfx;
+	// Set by the loading thread once everything above can be used
+	SDL_atomic_t sound_loaded;
+	SDL_Thread *sound_thread;
+	bool theme_pending;
+#endif
+	// Game status
+	GAME_STATUS status;
+	// Something on screen changed since the last present
+	bool dirty;
+	// Timing
+	uint32_t start_time;
+	uint32_t pause_time;
+	uint32_t pause_start;
+	uint32_t last_frame;
+	uint32_t last_move;
+	uint32_t last_rotate;
+	// Game time shown by the clock, frozen while paused or over
+	uint32_t last_ui;
+	// Board, bag, piece and score
+	TETRIS_GAME game;
+	// Effects in flight, drawn a step at a time with each frame
+	ANIM_SCHEDULER anims;
+	// Input recording, only active with a path
+	const char *replay_path;
+	REPLAY replay;
+	uint32_t replay_offset;
+	// Gameplay metrics, only recorded with a ring
+	TELEMETRY_RING *telemetry;
+	TELEMETRY_GAME telemetry_game;
+	// Performance counter at launch, cleared once the first frame is up
+	uint64_t startup;
+	bool startup_report;
+} TETRIS_STATE;
+
+// RENDER FUNCTIONS
+void render_layout(TETRIS_LAYOUT *layout, int width, int height);
+void render_load_assets(TETRIS_STATE *tetris);
+void render_free_assets(TETRIS_STATE *tetris);
+void draw_border(TETRIS_STATE *tetris);
+void draw_ui(TETRIS_STATE *tetris, uint32_t timestamp);
+void draw_bag(TETRIS_STATE *tetris);
+void draw_board(TETRIS_STATE *tetris);
+void draw_game_over(TETRIS_STATE *tetris);
+void animate_events(TETRIS_STATE *tetris, const TETRIS_GAME *before, int events,
+		    uint32_t now);
+void draw_animations(TETRIS_STATE *tetris, uint32_t now);
+
+// EXPORT FUNCTIONS
+int export_replay(const char *replay_path, const char *out_path, int threads,
+		  int fps);
+
+// WALL FUNCTIONS
+int wall_run(int local, int board_width, int board_height, int port,
+	     const uint32_t *watch, int nwatch, int seconds);
+
+#endif
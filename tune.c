@@ -0,0 +1,520 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "engine.h"
+#include "replay.h"
+#include "bot.h"
+
+// TUNER SETTINGS
+#define DEFAULT_POPULATION 32
+#define DEFAULT_GAMES 64
+#define DEFAULT_PIECES 500
+#define DEFAULT_GENERATIONS 100
+#define DEFAULT_CHECKPOINT "tune.ckpt"
+#define MAX_POPULATION 256
+#define MAX_WORKERS 256
+// Games handed to a worker at once, few enough that all of them stay busy
+// until the end of a generation.
+#define GAMES_PER_JOB 4
+// The best quarter carries over, the rest are bred from tournaments of four.
+#define ELITE_DIVISOR 4
+#define TOURNAMENT 4
+#define MUTATION_RATE 0.3
+#define MUTATION_SIZE 0.2
+
+// CHECKPOINT FORMAT
+#define TUNE_MAGIC 0x454E5554u
+#define TUNE_VERSION 2
+
+// STRUCTURE AND DATA DEFINITIONS
+// Sent to a worker process over its job pipe, well under PIPE_BUF.
+typedef struct TUNE_JOB {
+	uint32_t candidate;
+	uint32_t first_seed;
+	uint32_t games;
+	uint32_t pieces;
+	BOT_WEIGHTS weights;
+} TUNE_JOB;
+
+// And the answer on its result pipe.
+typedef struct TUNE_RESULT {
+	uint32_t candidate;
+	uint32_t games;
+	uint64_t score;
+	uint64_t lines;
+	uint64_t pieces;
+} TUNE_RESULT;
+
+// Written after every generation, everything needed to carry on.
+typedef struct TUNE_CHECKPOINT {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	// Next generation to evaluate
+	uint32_t generation;
+	// What the run was started with, which a resumed run has to keep to go
+	// on with the same games and objective.
+	uint32_t population;
+	uint32_t seed;
+	uint32_t games;
+	uint32_t pieces;
+	uint32_t rng;
+	// Best of the last finished generation
+	double best_fitness;
+	BOT_WEIGHTS best;
+	BOT_WEIGHTS candidates[MAX_POPULATION];
+} TUNE_CHECKPOINT;
+
+typedef struct WORKER {
+	pid_t pid;
+	int jobs;
+	int results;
+} WORKER;
+
+// HELPER FUNCTIONS
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t next_random(uint32_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 17;
+	*x ^= *x << 5;
+	return *x;
+}
+
+static double uniform(uint32_t *x)
+{
+	// In (0, 1], safe for the log below.
+	return (next_random(x) >> 8) / 16777216.0 + 1.0 / 16777216.0;
+}
+
+static double gaussian(uint32_t *x)
+{
+	// Box-Muller
+	return sqrt(-2 * log(uniform(x))) * cos(6.283185307179586 * uniform(x));
+}
+
+static void normalize(BOT_WEIGHTS *weights)
+{
+	// Scaling changes no decision, so unit length keeps the search bounded.
+	double length = 0;
+	for (int i = 0; i < NUM_BOT_FEATURES; i++)
+		length += weights->w[i] * weights->w[i];
+	length = sqrt(length);
+	if (length == 0)
+		return;
+	for (int i = 0; i < NUM_BOT_FEATURES; i++)
+		weights->w[i] /= length;
+}
+
+static bool read_full(int fd, void *data, size_t size)
+{
+	for (size_t done = 0; done < size;) {
+		ssize_t n = read(fd, (char *)data + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void *data, size_t size)
+{
+	for (size_t done = 0; done < size;) {
+		ssize_t n = write(fd, (const char *)data + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+// WORKER PROCESSES
+static void play_game(const BOT_WEIGHTS *weights, uint32_t seed, uint32_t pieces,
+		      TUNE_RESULT *result)
+{
+	// One placement at a time with a gravity step after each, which is
+	// also what ends a game that has topped out. Capped, or good weights
+	// would never finish.
+	TETRIS_GAME game;
+	uint8_t ops[BOT_MAX_OPS];
+	tetris_game_new(&game, WIDTH, HEIGHT, seed);
+	uint32_t placed = 0;
+	while (placed < pieces) {
+		int n = bot_plan(&game, weights, ops);
+		for (int i = 0; i < n; i++) {
+			int events = replay_apply(&game, ops[i]);
+			if (events & EVENT_CLEAR)
+				result->lines += __builtin_popcountll(game.clear_mask);
+		}
+		placed++;
+		int events = tetris_game_step(&game);
+		if (events & EVENT_GAME_OVER)
+			break;
+		if (events & EVENT_CLEAR)
+			result->lines += __builtin_popcountll(game.clear_mask);
+		if (events & EVENT_PLACE)
+			placed++;
+	}
+	result->score += game.score;
+	result->pieces += placed;
+}
+
+static void worker_main(int jobs, int results)
+{
+	// Plays whatever arrives until the tuner closes the pipe.
+	TUNE_JOB job;
+	while (read_full(jobs, &job, sizeof(job))) {
+		TUNE_RESULT result = { .candidate = job.candidate, .games = job.games };
+		for (uint32_t g = 0; g < job.games; g++)
+			play_game(&job.weights, job.first_seed + g, job.pieces, &result);
+		if (!write_full(results, &result, sizeof(result)))
+			break;
+	}
+	_exit(0);
+}
+
+static bool start_workers(WORKER *workers, int count)
+{
+	for (int i = 0; i < count; i++) {
+		int jobs[2], results[2];
+		if (pipe(jobs) != 0 || pipe(results) != 0)
+			return false;
+		pid_t pid = fork();
+		if (pid < 0)
+			return false;
+		if (pid == 0) {
+			// Only its own ends, so every worker sees the tuner go away.
+			for (int j = 0; j < i; j++) {
+				close(workers[j].jobs);
+				close(workers[j].results);
+			}
+			close(jobs[1]);
+			close(results[0]);
+			worker_main(jobs[0], results[1]);
+		}
+		close(jobs[0]);
+		close(results[1]);
+		workers[i] = (WORKER){ .pid = pid, .jobs = jobs[1], .results = results[0] };
+	}
+	return true;
+}
+
+static void stop_workers(WORKER *workers, int count)
+{
+	for (int i = 0; i < count; i++) {
+		close(workers[i].jobs);
+		close(workers[i].results);
+	}
+	for (int i = 0; i < count; i++)
+		waitpid(workers[i].pid, NULL, 0);
+}
+
+// EVALUATION
+static bool evaluate(WORKER *workers, int nworkers, const BOT_WEIGHTS *candidates,
+		     int count, uint32_t first_seed, int games, int pieces, TUNE_RESULT *totals)
+{
+	// Every candidate plays the same seeds, split into small jobs that go
+	// to whichever worker is free.
+	int per_candidate = (games + GAMES_PER_JOB - 1) / GAMES_PER_JOB;
+	int njobs = count * per_candidate;
+	int next = 0, done = 0;
+	struct pollfd fds[MAX_WORKERS];
+	memset(totals, 0, count * sizeof(*totals));
+
+	// Idle workers have a negative fd, which poll skips.
+	for (int i = 0; i < nworkers; i++)
+		fds[i] = (struct pollfd){ .fd = -1, .events = POLLIN };
+	while (done < njobs) {
+		for (int i = 0; i < nworkers && next < njobs; i++) {
+			if (fds[i].fd >= 0)
+				continue;
+			int c = next / per_candidate, chunk = next % per_candidate;
+			TUNE_JOB job = {
+				.candidate = c,
+				.first_seed = first_seed + chunk * GAMES_PER_JOB,
+				.games = games - chunk * GAMES_PER_JOB < GAMES_PER_JOB ?
+					 games - chunk * GAMES_PER_JOB : GAMES_PER_JOB,
+				.pieces = pieces,
+				.weights = candidates[c],
+			};
+			if (!write_full(workers[i].jobs, &job, sizeof(job)))
+				return false;
+			fds[i].fd = workers[i].results;
+			next++;
+		}
+		if (poll(fds, nworkers, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		for (int i = 0; i < nworkers; i++) {
+			if (fds[i].fd < 0 || !fds[i].revents)
+				continue;
+			TUNE_RESULT result;
+			if (!read_full(workers[i].results, &result, sizeof(result)))
+				return false;
+			TUNE_RESULT *total = &totals[result.candidate];
+			total->games += result.games;
+			total->score += result.score;
+			total->lines += result.lines;
+			total->pieces += result.pieces;
+			fds[i].fd = -1;
+			done++;
+		}
+	}
+	return true;
+}
+
+// BREEDING
+static int tournament(const double *fitness, int count, uint32_t *rng)
+{
+	int best = next_random(rng) % count;
+	for (int i = 1; i < TOURNAMENT; i++) {
+		int other = next_random(rng) % count;
+		if (fitness[other] > fitness[best])
+			best = other;
+	}
+	return best;
+}
+
+static void breed(BOT_WEIGHTS *candidates, const double *fitness, int count, uint32_t *rng)
+{
+	// Elites carry over, children are the fitness weighted average of two
+	// tournament winners with the odd feature nudged.
+	BOT_WEIGHTS next[MAX_POPULATION];
+	int order[MAX_POPULATION];
+	for (int i = 0; i < count; i++)
+		order[i] = i;
+	for (int i = 1; i < count; i++)
+		for (int j = i; j > 0 && fitness[order[j]] > fitness[order[j - 1]]; j--) {
+			int t = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = t;
+		}
+
+	int elites = count / ELITE_DIVISOR > 0 ? count / ELITE_DIVISOR : 1;
+	for (int i = 0; i < elites; i++)
+		next[i] = candidates[order[i]];
+	for (int i = elites; i < count; i++) {
+		int a = tournament(fitness, count, rng);
+		int b = tournament(fitness, count, rng);
+		for (int f = 0; f < NUM_BOT_FEATURES; f++)
+			next[i].w[f] = (fitness[a] + 1) * candidates[a].w[f] +
+				       (fitness[b] + 1) * candidates[b].w[f];
+		normalize(&next[i]);
+		if (uniform(rng) < MUTATION_RATE)
+			next[i].w[next_random(rng) % NUM_BOT_FEATURES] += gaussian(rng) * MUTATION_SIZE;
+		normalize(&next[i]);
+	}
+	memcpy(candidates, next, count * sizeof(*candidates));
+}
+
+// CHECKPOINTS
+static bool checkpoint_load(const char *path, TUNE_CHECKPOINT *ckpt)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+	bool ok = fread(ckpt, sizeof(*ckpt), 1, file) == 1 && ckpt->magic == TUNE_MAGIC &&
+		  ckpt->version == TUNE_VERSION && ckpt->size == sizeof(*ckpt) &&
+		  ckpt->population >= 2 && ckpt->population <= MAX_POPULATION &&
+		  ckpt->seed && ckpt->games && ckpt->pieces;
+	fclose(file);
+	return ok;
+}
+
+static bool checkpoint_keeps(const char *path, const char *flag, bool given, uint32_t value,
+			     uint32_t saved)
+{
+	// A flag left out takes the checkpoint's value, a different one is an
+	// error rather than a change of course halfway through.
+	if (!given || value == saved)
+		return true;
+	fprintf(stderr, "%s was started with %s %u, not %u; use another --checkpoint "
+		"to start over\n", path, flag, saved, value);
+	return false;
+}
+
+static bool checkpoint_save(const char *path, const TUNE_CHECKPOINT *ckpt)
+{
+	// Written aside and renamed over, a crash never leaves half a file.
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *file = fopen(tmp, "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(ckpt, sizeof(*ckpt), 1, file) == 1;
+	ok = fclose(file) == 0 && ok;
+	return ok && rename(tmp, path) == 0;
+}
+
+static void print_weights(const char *prefix, const BOT_WEIGHTS *weights)
+{
+	printf("%s", prefix);
+	for (int i = 0; i < NUM_BOT_FEATURES; i++)
+		printf(" %s %.4f", bot_feature_names[i], weights->w[i]);
+	printf("\n");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [--workers N] [--population N] [--games N] [--pieces N]\n"
+		"          [--generations N] [--seed N] [--checkpoint FILE]\n"
+		"Tunes the bot weights with a genetic search. Every candidate plays\n"
+		"the same seeded games each generation, spread over worker processes.\n"
+		"The checkpoint is written after every generation and picked up again\n"
+		"on the next start.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	int population = DEFAULT_POPULATION;
+	int games = DEFAULT_GAMES;
+	int pieces = DEFAULT_PIECES;
+	int generations = DEFAULT_GENERATIONS;
+	uint32_t seed = 1;
+	const char *path = DEFAULT_CHECKPOINT;
+	bool population_given = false, games_given = false, pieces_given = false;
+	bool seed_given = false;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+			workers = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "--population") && i + 1 < argc) {
+			population = atoi(argv[++i]);
+			population_given = true;
+		} else if (!strcmp(argv[i], "--games") && i + 1 < argc) {
+			games = atoi(argv[++i]);
+			games_given = true;
+		} else if (!strcmp(argv[i], "--pieces") && i + 1 < argc) {
+			pieces = atoi(argv[++i]);
+			pieces_given = true;
+		} else if (!strcmp(argv[i], "--generations") && i + 1 < argc) {
+			generations = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			seed = strtoul(argv[++i], NULL, 10);
+			seed_given = true;
+		} else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc) {
+			path = argv[++i];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (workers < 1 || workers > MAX_WORKERS || population < 2 ||
+	    population > MAX_POPULATION || games < 1 || pieces < 1 || seed == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	static TUNE_CHECKPOINT ckpt;
+	if (checkpoint_load(path, &ckpt)) {
+		if (!checkpoint_keeps(path, "--population", population_given, population,
+				      ckpt.population) ||
+		    !checkpoint_keeps(path, "--seed", seed_given, seed, ckpt.seed) ||
+		    !checkpoint_keeps(path, "--games", games_given, games, ckpt.games) ||
+		    !checkpoint_keeps(path, "--pieces", pieces_given, pieces, ckpt.pieces))
+			return 1;
+		population = ckpt.population;
+		seed = ckpt.seed;
+		games = ckpt.games;
+		pieces = ckpt.pieces;
+		printf("Resuming %s at generation %u\n", path, ckpt.generation);
+	} else {
+		// The hand tuned weights and random directions around them.
+		memset(&ckpt, 0, sizeof(ckpt));
+		ckpt.magic = TUNE_MAGIC;
+		ckpt.version = TUNE_VERSION;
+		ckpt.size = sizeof(ckpt);
+		ckpt.population = population;
+		ckpt.seed = seed;
+		ckpt.games = games;
+		ckpt.pieces = pieces;
+		ckpt.rng = seed;
+		ckpt.candidates[0] = bot_default_weights;
+		normalize(&ckpt.candidates[0]);
+		for (int i = 1; i < population; i++) {
+			for (int f = 0; f < NUM_BOT_FEATURES; f++)
+				ckpt.candidates[i].w[f] = uniform(&ckpt.rng) * 2 - 1;
+			normalize(&ckpt.candidates[i]);
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	static WORKER pool[MAX_WORKERS];
+	if (!start_workers(pool, workers)) {
+		perror("workers");
+		return 1;
+	}
+
+	static TUNE_RESULT totals[MAX_POPULATION];
+	double fitness[MAX_POPULATION];
+	while ((int)ckpt.generation < generations) {
+		double start = now_seconds();
+		// New seeds every generation, so nothing is tuned to a few games.
+		uint32_t first_seed = seed + ckpt.generation * (uint32_t)games;
+		if (!evaluate(pool, workers, ckpt.candidates, population, first_seed, games,
+			      pieces, totals)) {
+			fprintf(stderr, "A worker went away\n");
+			stop_workers(pool, workers);
+			return 1;
+		}
+		double elapsed = now_seconds() - start;
+
+		int best = 0;
+		double mean = 0;
+		for (int i = 0; i < population; i++) {
+			fitness[i] = (double)totals[i].score / totals[i].games;
+			mean += fitness[i] / population;
+			if (fitness[i] > fitness[best])
+				best = i;
+		}
+		ckpt.best = ckpt.candidates[best];
+		ckpt.best_fitness = fitness[best];
+		printf("generation %u: best %.0f mean %.0f, %.1f lines %.0f pieces a game, "
+		       "%.0f games/s\n", ckpt.generation, fitness[best], mean,
+		       (double)totals[best].lines / totals[best].games,
+		       (double)totals[best].pieces / totals[best].games,
+		       population * games / elapsed);
+		print_weights("   ", &ckpt.best);
+		fflush(stdout);
+
+		breed(ckpt.candidates, fitness, population, &ckpt.rng);
+		ckpt.generation++;
+		if (!checkpoint_save(path, &ckpt))
+			fprintf(stderr, "Unable to write %s\n", path);
+	}
+	stop_workers(pool, workers);
+
+	printf("Best weights, for bot_default_weights in bot.c:\n");
+	for (int i = 0; i < NUM_BOT_FEATURES; i++) {
+		printf("\t[BOT_");
+		for (const char *c = bot_feature_names[i]; *c; c++)
+			putchar(toupper((unsigned char)*c));
+		printf("] = %.4f,\n", ckpt.best.w[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,537 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "tetris.h"
+#include "engine.h"
+#include "replay.h"
+#include "bot.h"
+
+#if !defined(WASM) && !defined(_WIN32)
+#define WALL_WATCH
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "spectate.h"
+#endif
+
+// WALL SETTINGS
+#define WALL_WIDTH 1280
+#define WALL_HEIGHT 720
+// Local games make one input this often
+#define WALL_INPUT_MS 50
+// Finished local games stay up this long before starting again
+#define WALL_RESTART_MS 2000
+// Glyphs in the text atlas
+#define FIRST_GLYPH ' '
+#define LAST_GLYPH '~'
+#define ATLAS_WIDTH 1024
+// Status a spectated game reports once it is over, see server.c
+#define WATCH_GAME_OVER 3
+#define WATCH_BUFFER 4096
+
+// STRUCTURE AND DATA DEFINITIONS
+typedef struct WALL_GLYPH {
+	SDL_FRect src;
+	float advance;
+} WALL_GLYPH;
+
+typedef struct WALL_BOARD {
+	TETRIS_GAME game;
+	bool over;
+	// Watched game with nothing to show yet, or no longer connected
+	bool waiting;
+	// Local games, played by bot.c with its default weights
+	uint32_t last_move;
+	uint32_t last_input;
+	uint32_t over_time;
+	uint8_t pending[BOT_MAX_OPS];
+	int npending;
+#ifdef WALL_WATCH
+	// Watched games, fed by a spectator stream
+	int fd;
+	SPECTATE_DECODER decoder;
+	uint8_t in[WATCH_BUFFER];
+	size_t in_len;
+#endif
+} WALL_BOARD;
+
+// Where a board goes on screen, the per viewport transform_coords.
+typedef struct WALL_VIEW {
+	float x;
+	float y;
+	float square;
+} WALL_VIEW;
+
+// Every quad of a frame, drawn with one call per texture.
+typedef struct WALL_BATCH {
+	SDL_Texture *texture;
+	float texture_w;
+	float texture_h;
+	SDL_Vertex *vertices;
+	int *indices;
+	int quads;
+	int capacity;
+} WALL_BATCH;
+
+typedef struct WALL {
+	TETRIS_STATE tetris;
+	SDL_Texture *text;
+	WALL_GLYPH glyphs[LAST_GLYPH - FIRST_GLYPH + 1];
+	float glyph_height;
+	WALL_BOARD *boards;
+	int count;
+	// Board size in cells the grid is laid out for
+	int cell_w;
+	int cell_h;
+	int cols;
+	WALL_VIEW view;
+	WALL_BATCH tiles;
+	WALL_BATCH glyph_batch;
+} WALL;
+
+// TEXT ATLAS
+static bool wall_build_text(WALL *wall)
+{
+	// Every printable glyph rendered once into one texture, so text is
+	// just more quads instead of a surface and texture per string.
+	TTF_Font *font = wall->tetris.big_font;
+	static const SDL_Color white = { 255, 255, 255, 255 };
+	int line = TTF_FontHeight(font);
+	int x = 0, y = 0;
+	SDL_Surface *atlas = SDL_CreateRGBSurfaceWithFormat(0, ATLAS_WIDTH, line * 4, 32,
+							    SDL_PIXELFORMAT_RGBA32);
+	if (!atlas)
+		return false;
+	for (int c = FIRST_GLYPH; c <= LAST_GLYPH; c++) {
+		SDL_Surface *glyph = TTF_RenderGlyph_Blended(font, c, white);
+		if (!glyph)
+			continue;
+		if (x + glyph->w > ATLAS_WIDTH) {
+			x = 0;
+			y += line;
+		}
+		if (y + glyph->h > atlas->h) {
+			SDL_FreeSurface(glyph);
+			break;
+		}
+		SDL_Rect dst = { x, y, glyph->w, glyph->h };
+		SDL_SetSurfaceBlendMode(glyph, SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(glyph, NULL, atlas, &dst);
+		wall->glyphs[c - FIRST_GLYPH] = (WALL_GLYPH){
+			.src = { x, y, glyph->w, glyph->h },
+			.advance = glyph->w,
+		};
+		x += glyph->w + 1;
+		SDL_FreeSurface(glyph);
+	}
+	wall->glyph_height = line;
+	wall->text = SDL_CreateTextureFromSurface(wall->tetris.renderer, atlas);
+	SDL_FreeSurface(atlas);
+	if (!wall->text)
+		return false;
+	SDL_SetTextureBlendMode(wall->text, SDL_BLENDMODE_BLEND);
+	wall->glyph_batch.texture = wall->text;
+	wall->glyph_batch.texture_w = ATLAS_WIDTH;
+	wall->glyph_batch.texture_h = line * 4;
+	return true;
+}
+
+// BATCHING
+static bool batch_reserve(WALL_BATCH *batch, int quads)
+{
+	if (batch->quads + quads <= batch->capacity)
+		return true;
+	int capacity = batch->capacity ? batch->capacity * 2 : 4096;
+	while (capacity < batch->quads + quads)
+		capacity *= 2;
+	SDL_Vertex *vertices = realloc(batch->vertices, capacity * 4 * sizeof(SDL_Vertex));
+	if (!vertices)
+		return false;
+	batch->vertices = vertices;
+	int *indices = realloc(batch->indices, capacity * 6 * sizeof(int));
+	if (!indices)
+		return false;
+	batch->indices = indices;
+	// Quads always use the same six indices, fill them in once.
+	for (int q = batch->capacity; q < capacity; q++) {
+		static const int corners[6] = { 0, 1, 2, 2, 1, 3 };
+		for (int i = 0; i < 6; i++)
+			indices[q * 6 + i] = q * 4 + corners[i];
+	}
+	batch->capacity = capacity;
+	return true;
+}
+
+static void batch_quad(WALL_BATCH *batch, SDL_FRect dst, SDL_FRect src, SDL_Color color)
+{
+	if (!batch_reserve(batch, 1))
+		return;
+	float u0 = src.x / batch->texture_w, u1 = (src.x + src.w) / batch->texture_w;
+	float v0 = src.y / batch->texture_h, v1 = (src.y + src.h) / batch->texture_h;
+	SDL_Vertex *v = &batch->vertices[batch->quads * 4];
+	v[0] = (SDL_Vertex){ { dst.x, dst.y }, color, { u0, v0 } };
+	v[1] = (SDL_Vertex){ { dst.x + dst.w, dst.y }, color, { u1, v0 } };
+	v[2] = (SDL_Vertex){ { dst.x, dst.y + dst.h }, color, { u0, v1 } };
+	v[3] = (SDL_Vertex){ { dst.x + dst.w, dst.y + dst.h }, color, { u1, v1 } };
+	batch->quads++;
+}
+
+static void batch_draw(SDL_Renderer *renderer, WALL_BATCH *batch)
+{
+	if (batch->quads)
+		SDL_RenderGeometry(renderer, batch->texture, batch->vertices,
+				   batch->quads * 4, batch->indices, batch->quads * 6);
+	batch->quads = 0;
+}
+
+// BOARD DRAWING
+static SDL_FRect view_coords(const WALL_VIEW *view, int x, int y)
+{
+	// Cell x, y of a board, with the border at -1 and the text row above it.
+	return (SDL_FRect){
+		       .x = view->x + (x + 1) * view->square,
+		       .y = view->y + (y + 2) * view->square,
+		       .w = view->square,
+		       .h = view->square,
+	};
+}
+
+static void wall_tile(WALL *wall, const WALL_VIEW *view, char c, int x, int y)
+{
+	// Same atlas order as draw_tile in render.c: border, then the pieces.
+	static const char order[] = "IOTSZJL";
+	int index = 0;
+	if (c) {
+		const char *p = strchr(order, c);
+		if (!p)
+			return;
+		index = (int)(p - order) + 1;
+	}
+	static const SDL_Color white = { 255, 255, 255, 255 };
+	SDL_FRect src = { index * 32, 0, 32, 32 };
+	batch_quad(&wall->tiles, view_coords(view, x, y), src, white);
+}
+
+static void wall_text(WALL *wall, const WALL_VIEW *view, const char *s, SDL_Color color)
+{
+	// One row of text across the top of the board, scaled to a square.
+	float scale = view->square / wall->glyph_height;
+	float x = view->x + view->square;
+	for (; *s; s++) {
+		if (*s < FIRST_GLYPH || *s > LAST_GLYPH)
+			continue;
+		const WALL_GLYPH *g = &wall->glyphs[*s - FIRST_GLYPH];
+		SDL_FRect dst = { x, view->y, g->src.w * scale, g->src.h * scale };
+		if (g->src.w > 0)
+			batch_quad(&wall->glyph_batch, dst, g->src, color);
+		x += g->advance * scale;
+	}
+}
+
+static void wall_draw_board(WALL *wall, const WALL_VIEW *view, const WALL_BOARD *board)
+{
+	const TETRIS_GAME *game = &board->game;
+	char line[32];
+	if (board->waiting)
+		snprintf(line, sizeof(line), "...");
+	else
+		snprintf(line, sizeof(line), "%u L%u%s", game->score, game->level,
+			 board->over ? " OVER" : "");
+	static const SDL_Color white = { 255, 255, 255, 255 };
+	static const SDL_Color red = { 255, 96, 96, 255 };
+	wall_text(wall, view, line, board->over ? red : white);
+
+	for (int y = -1; y <= game->height; y++) {
+		wall_tile(wall, view, 0, -1, y);
+		wall_tile(wall, view, 0, game->width, y);
+	}
+	for (int x = 0; x < game->width; x++) {
+		wall_tile(wall, view, 0, x, -1);
+		wall_tile(wall, view, 0, x, game->height);
+	}
+	if (board->waiting)
+		return;
+	for (int i = 0; i < game->width * game->height; i++)
+		if (game->board[i] != '.')
+			wall_tile(wall, view, game->board[i], i % game->width, i / game->width);
+	if (board->over)
+		return;
+	for (int i = 0; i < TETROMINO_SIZE; i++) {
+		char c = tetromino[game->tetromino_type][i];
+		if (c == '.')
+			continue;
+		int index = tetromino_translate_rotation(i % TETROMINO_WIDTH, i / TETROMINO_WIDTH,
+							 game->tetromino_type,
+							 game->tetromino_rotation);
+		int y = game->tetromino_y + index / TETROMINO_WIDTH;
+		if (y >= 0)
+			wall_tile(wall, view, c, game->tetromino_x + index % TETROMINO_WIDTH, y);
+	}
+}
+
+static void wall_layout(WALL *wall, int width, int height)
+{
+	// Pick the column count that gives the biggest squares. A board takes
+	// its cells plus the border on each side and a row of text on top.
+	float cell_w = wall->cell_w + 2;
+	float cell_h = wall->cell_h + 3;
+	wall->cols = 1;
+	wall->view.square = 0;
+	for (int cols = 1; cols <= wall->count; cols++) {
+		int rows = (wall->count + cols - 1) / cols;
+		float square = fminf(width / (cols * cell_w), height / (rows * cell_h));
+		if (square > wall->view.square) {
+			wall->view.square = square;
+			wall->cols = cols;
+		}
+	}
+}
+
+static void wall_render(WALL *wall)
+{
+	SDL_Renderer *renderer = wall->tetris.renderer;
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_RenderClear(renderer);
+	for (int i = 0; i < wall->count; i++) {
+		WALL_VIEW view = wall->view;
+		view.x = (i % wall->cols) * (wall->cell_w + 2) * view.square;
+		view.y = (i / wall->cols) * (wall->cell_h + 3) * view.square;
+		wall_draw_board(wall, &view, &wall->boards[i]);
+	}
+	// All the boards, then all the text: two draw calls for the whole wall.
+	batch_draw(renderer, &wall->tiles);
+	batch_draw(renderer, &wall->glyph_batch);
+	SDL_RenderPresent(renderer);
+}
+
+// LOCAL GAMES
+static void wall_update_local(WALL_BOARD *board, uint32_t now)
+{
+	if (board->over) {
+		if (now - board->over_time < WALL_RESTART_MS)
+			return;
+		tetris_game_reset(&board->game, board->game.rng);
+		board->over = false;
+		board->npending = 0;
+		board->last_move = now;
+	}
+	int events = 0;
+	if ((int32_t)(now - board->last_input) >= WALL_INPUT_MS) {
+		if (board->npending == 0)
+			board->npending = bot_plan(&board->game, &bot_default_weights,
+						   board->pending);
+		// Inputs are consumed from the front.
+		events |= replay_apply(&board->game, board->pending[0]);
+		memmove(board->pending, board->pending + 1, --board->npending);
+		board->last_input = now;
+	}
+	if ((int32_t)(now - board->last_move) >= tetris_move_delay(&board->game)) {
+		events |= tetris_game_step(&board->game);
+		board->last_move = now;
+	}
+	if (events & EVENT_PLACE)
+		board->npending = 0;
+	if (events & EVENT_GAME_OVER) {
+		board->over = true;
+		board->over_time = now;
+	}
+}
+
+// WATCHED GAMES
+#ifdef WALL_WATCH
+static int wall_connect(int port, uint32_t id)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	uint8_t hello[4] = { id >> 24, id >> 16, id >> 8, id };
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    write(fd, hello, sizeof(hello)) != sizeof(hello) ||
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void wall_update_watched(WALL_BOARD *board)
+{
+	for (;;) {
+		ssize_t n = read(board->fd, board->in + board->in_len,
+				 sizeof(board->in) - board->in_len);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			break;
+		if (n <= 0) {
+			close(board->fd);
+			board->fd = -1;
+			board->waiting = true;
+			return;
+		}
+		board->in_len += n;
+
+		size_t len;
+		while ((len = spectate_frame_length(board->in, board->in_len)) &&
+		       len <= board->in_len) {
+			// Out of sync only until the next keyframe comes along.
+			spectate_apply(&board->decoder, board->in, len);
+			memmove(board->in, board->in + len, board->in_len - len);
+			board->in_len -= len;
+		}
+	}
+	if (board->decoder.synced) {
+		board->game = board->decoder.game;
+		board->over = board->decoder.status == WATCH_GAME_OVER;
+		board->waiting = false;
+	}
+}
+#endif
+
+// WALL
+int wall_run(int local, int board_width, int board_height, int port,
+	     const uint32_t *watch, int nwatch, int seconds)
+{
+	WALL wall = { 0 };
+	wall.count = local + nwatch;
+	wall.boards = calloc(wall.count ? wall.count : 1, sizeof(WALL_BOARD));
+	if (!wall.count || !wall.boards) {
+		free(wall.boards);
+		return 1;
+	}
+	// The grid is laid out for the largest board on it.
+	wall.cell_w = nwatch ? WIDTH : board_width;
+	wall.cell_h = nwatch ? HEIGHT : board_height;
+	if (local) {
+		wall.cell_w = board_width > wall.cell_w ? board_width : wall.cell_w;
+		wall.cell_h = board_height > wall.cell_h ? board_height : wall.cell_h;
+	}
+	uint32_t now = SDL_GetTicks();
+	for (int i = 0; i < local; i++) {
+		WALL_BOARD *board = &wall.boards[i];
+		tetris_game_new(&board->game, board_width, board_height,
+				(uint32_t)time(NULL) * 2654435761u + i);
+		board->last_move = now;
+		board->last_input = now + i * WALL_INPUT_MS / (local ? local : 1);
+	}
+	for (int i = 0; i < nwatch; i++) {
+		WALL_BOARD *board = &wall.boards[local + i];
+		tetris_game_new(&board->game, WIDTH, HEIGHT, 1);
+#ifdef WALL_WATCH
+		board->fd = wall_connect(port, watch[i]);
+		if (board->fd < 0)
+			fprintf(stderr, "Unable to watch game %u on port %d\n", watch[i], port);
+#else
+		(void)port;
+		(void)watch;
+#endif
+		board->waiting = true;
+	}
+
+	// The usual tile atlas and fonts, loaded by render_load_assets.
+	TETRIS_STATE *tetris = &wall.tetris;
+	render_layout(&tetris->layout, WIDTH, HEIGHT);
+	tetris->window = SDL_CreateWindow(WINDOW_TITLE, SDL_WINDOWPOS_UNDEFINED,
+					  SDL_WINDOWPOS_UNDEFINED, WALL_WIDTH, WALL_HEIGHT,
+					  SDL_WINDOW_RESIZABLE);
+	tetris->renderer = SDL_CreateRenderer(tetris->window, -1,
+					      SDL_RENDERER_ACCELERATED |
+					      SDL_RENDERER_PRESENTVSYNC);
+	if (!tetris->window || !tetris->renderer) {
+		fprintf(stderr, "Unable to create window: %s\n", SDL_GetError());
+		free(wall.boards);
+		return 1;
+	}
+	SDL_SetRenderDrawBlendMode(tetris->renderer, SDL_BLENDMODE_BLEND);
+	render_load_assets(tetris);
+	int tiles_w, tiles_h;
+	SDL_QueryTexture(tetris->tiles, NULL, NULL, &tiles_w, &tiles_h);
+	wall.tiles.texture = tetris->tiles;
+	wall.tiles.texture_w = tiles_w;
+	wall.tiles.texture_h = tiles_h;
+	int ret = 0;
+	if (!wall_build_text(&wall)) {
+		fprintf(stderr, "Unable to build the text atlas: %s\n", SDL_GetError());
+		ret = 1;
+		goto out;
+	}
+	int width, height;
+	SDL_GetRendererOutputSize(tetris->renderer, &width, &height);
+	wall_layout(&wall, width, height);
+
+	// Frame rate goes in the title once a second, and the average is
+	// printed at the end.
+	uint32_t start = SDL_GetTicks(), second = start;
+	long frames = 0, second_frames = 0;
+	bool running = true;
+	while (running) {
+		SDL_Event event;
+		while (SDL_PollEvent(&event)) {
+			if (event.type == SDL_QUIT ||
+			    (event.type == SDL_KEYDOWN &&
+			     event.key.keysym.scancode == SDL_SCANCODE_ESCAPE))
+				running = false;
+			else if (event.type == SDL_WINDOWEVENT &&
+				 event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+				SDL_GetRendererOutputSize(tetris->renderer, &width, &height);
+				wall_layout(&wall, width, height);
+			}
+		}
+		now = SDL_GetTicks();
+		for (int i = 0; i < local; i++)
+			wall_update_local(&wall.boards[i], now);
+#ifdef WALL_WATCH
+		for (int i = local; i < wall.count; i++)
+			if (wall.boards[i].fd >= 0)
+				wall_update_watched(&wall.boards[i]);
+#endif
+		wall_render(&wall);
+		frames++;
+		second_frames++;
+		if (now - second >= 1000) {
+			char title[64];
+			snprintf(title, sizeof(title), "%s - %d boards - %ld fps", WINDOW_TITLE,
+				 wall.count, second_frames * 1000 / (now - second));
+			SDL_SetWindowTitle(tetris->window, title);
+			second = now;
+			second_frames = 0;
+		}
+		if (seconds > 0 && now - start >= (uint32_t)seconds * 1000)
+			running = false;
+	}
+	double elapsed = (SDL_GetTicks() - start) / 1000.0;
+	printf("%d boards, %ld frames in %.1f s, %.1f fps\n", wall.count, frames, elapsed,
+	       elapsed > 0 ? frames / elapsed : 0);
+
+out:
+#ifdef WALL_WATCH
+	for (int i = local; i < wall.count; i++)
+		if (wall.boards[i].fd >= 0)
+			close(wall.boards[i].fd);
+#endif
+	free(wall.tiles.vertices);
+	free(wall.tiles.indices);
+	free(wall.glyph_batch.vertices);
+	free(wall.glyph_batch.indices);
+	if (wall.text)
+		SDL_DestroyTexture(wall.text);
+	render_free_assets(tetris);
+	SDL_DestroyRenderer(tetris->renderer);
+	SDL_DestroyWindow(tetris->window);
+	free(wall.boards);
+	return ret;
+}
@@ -0,0 +1,119 @@
+// Benchmark of the headless wasm build, see worker.c and make wasm-bench.
+//
+//   node wasm-bench.js out/tetris-engine.js [--seconds N] [--games N] [--threads N]
+//
+// Plays bot games the way a page would, first with every placement search
+// on the calling thread, then with them queued to the search threads and
+// polled once per turn of the event loop. Reports placements per second and
+// the longest the calling thread was held up in one turn, which is what a
+// frame would lose.
+"use strict";
+
+const path = require("path");
+
+// Values from replay.h, engine.h and bot.h
+const REPLAY_STEP = 3;
+const REPLAY_RESET = 5;
+const EVENT_GAME_OVER = 1 << 5;
+const BOT_MAX_OPS = 4 + 16 + 2;
+
+function usage() {
+  console.error(
+    "Usage: node wasm-bench.js ENGINE.js [--seconds N] [--games N] [--threads N]"
+  );
+  process.exit(1);
+}
+
+function parseArgs(argv) {
+  const args = { module: null, seconds: 4, games: 16, threads: 4 };
+  for (let i = 0; i < argv.length; i++) {
+    const name = argv[i].replace(/^--/, "");
+    if (argv[i].startsWith("--") && name in args && i + 1 < argv.length)
+      args[name] = Number(argv[++i]);
+    else if (!argv[i].startsWith("--") && !args.module) args.module = argv[i];
+    else usage();
+  }
+  if (!args.module || !(args.seconds > 0) || !(args.games > 0)) usage();
+  return args;
+}
+
+function play(engine, game, ops, count) {
+  // The planned inputs, then gravity, starting over when the game ends.
+  for (let i = 0; i < count; i++)
+    engine._worker_game_apply(game, engine.HEAPU8[ops + i]);
+  if (engine._worker_game_apply(game, REPLAY_STEP) & EVENT_GAME_OVER)
+    engine._worker_game_apply(game, REPLAY_RESET);
+}
+
+function nextTurn() {
+  return new Promise((resolve) => setImmediate(resolve));
+}
+
+async function benchCallingThread(engine, games, ops, seconds) {
+  // One search per turn, the least a page without threads would stall for.
+  let plans = 0;
+  let longest = 0;
+  const start = performance.now();
+  while (performance.now() - start < seconds * 1000) {
+    const game = games[plans % games.length];
+    const turn = performance.now();
+    play(engine, game, ops, engine._worker_plan_now(game, 0, ops));
+    longest = Math.max(longest, performance.now() - turn);
+    plans++;
+    await nextTurn();
+  }
+  return { rate: plans / ((performance.now() - start) / 1000), longest };
+}
+
+async function benchThreads(engine, games, ops, seconds) {
+  // Every game keeps a search queued, a turn only collects finished ones.
+  const jobs = games.map((game) => engine._worker_plan(game, 0));
+  let plans = 0;
+  let longest = 0;
+  const start = performance.now();
+  while (performance.now() - start < seconds * 1000) {
+    const turn = performance.now();
+    games.forEach((game, i) => {
+      if (jobs[i] >= 0) {
+        const count = engine._worker_poll(jobs[i], ops);
+        if (count < 0) return;
+        play(engine, game, ops, count);
+        plans++;
+      }
+      jobs[i] = engine._worker_plan(game, 0);
+    });
+    longest = Math.max(longest, performance.now() - turn);
+    await nextTurn();
+  }
+  return { rate: plans / ((performance.now() - start) / 1000), longest };
+}
+
+async function main() {
+  const args = parseArgs(process.argv.slice(2));
+  const createEngine = require(path.resolve(args.module));
+  const engine = await createEngine();
+  const threads = engine._worker_start(args.threads);
+  const ops = engine._malloc(BOT_MAX_OPS);
+  const games = [];
+  for (let i = 0; i < args.games; i++)
+    games.push(engine._worker_game_new(10, 20, i + 1));
+
+  const report = (label, result) =>
+    console.log(
+      `${label.padEnd(16)} ${(result.rate / 1e3).toFixed(2).padStart(8)} K placements/s` +
+        `  longest turn ${result.longest.toFixed(3)} ms`
+    );
+  report("calling thread", await benchCallingThread(engine, games, ops, args.seconds / 2));
+  report(`${threads} threads`, await benchThreads(engine, games, ops, args.seconds / 2));
+
+  engine._worker_stop();
+  games.forEach((game) => engine._worker_game_free(game));
+  engine._free(ops);
+  // The search threads are node workers and would keep it running.
+  process.exit(0);
+}
+
+main().catch((error) => {
+  console.error(error);
+  process.exit(1);
+});
@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#define WORKER_EXPORT EMSCRIPTEN_KEEPALIVE
+#else
+#define WORKER_EXPORT
+#endif
+
+#include "worker.h"
+#include "replay.h"
+
+// STRUCTURE AND DATA DEFINITIONS
+typedef enum JOB_STATE {
+	JOB_FREE,
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+} JOB_STATE;
+
+// A job belongs to the page while free or done and to a search thread
+// while queued or running, the state hands it over.
+typedef struct WORKER_JOB {
+	_Atomic int state;
+	TETRIS_GAME game;
+	BOT_WEIGHTS weights;
+	int count;
+	uint8_t ops[BOT_MAX_OPS];
+} WORKER_JOB;
+
+static WORKER_JOB jobs[WORKER_JOBS];
+// Posted once per queued job, never waited on by the page.
+static sem_t queued;
+static atomic_bool stopping;
+static pthread_t threads[WORKER_MAX_THREADS];
+static int thread_count;
+
+// SEARCH THREADS
+static void *worker_run(void *data)
+{
+	(void)data;
+	while (true) {
+		sem_wait(&queued);
+		if (atomic_load(&stopping))
+			return NULL;
+		// Not necessarily the job that was posted for, but there is one
+		// queued job left for every wakeup.
+		for (int i = 0; i < WORKER_JOBS; i++) {
+			int expected = JOB_QUEUED;
+			if (atomic_compare_exchange_strong(&jobs[i].state, &expected, JOB_RUNNING)) {
+				jobs[i].count = bot_plan(&jobs[i].game, &jobs[i].weights, jobs[i].ops);
+				atomic_store(&jobs[i].state, JOB_DONE);
+				break;
+			}
+		}
+	}
+}
+
+WORKER_EXPORT int worker_start(int count)
+{
+	if (thread_count)
+		return thread_count;
+	if (count > WORKER_MAX_THREADS)
+		count = WORKER_MAX_THREADS;
+	if (sem_init(&queued, 0, 0) != 0)
+		return 0;
+	atomic_store(&stopping, false);
+	// Under emscripten these come from the prestarted pool, so creating
+	// them does not have to wait for the page to yield.
+	while (thread_count < count &&
+	       pthread_create(&threads[thread_count], NULL, worker_run, NULL) == 0)
+		thread_count++;
+	// worker_stop only tears down what a running pool uses.
+	if (!thread_count)
+		sem_destroy(&queued);
+	return thread_count;
+}
+
+WORKER_EXPORT void worker_stop(void)
+{
+	atomic_store(&stopping, true);
+	for (int i = 0; i < thread_count; i++)
+		sem_post(&queued);
+	for (int i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	if (thread_count)
+		sem_destroy(&queued);
+	thread_count = 0;
+	for (int i = 0; i < WORKER_JOBS; i++)
+		atomic_store(&jobs[i].state, JOB_FREE);
+}
+
+// GAME FUNCTIONS
+WORKER_EXPORT TETRIS_GAME *worker_game_new(int width, int height, uint32_t seed)
+{
+	if (!tetris_board_size_valid(width, height))
+		return NULL;
+	TETRIS_GAME *game = malloc(sizeof(TETRIS_GAME));
+	if (game)
+		tetris_game_new(game, width, height, seed);
+	return game;
+}
+
+WORKER_EXPORT void worker_game_free(TETRIS_GAME *game)
+{
+	free(game);
+}
+
+WORKER_EXPORT int worker_game_apply(TETRIS_GAME *game, int op)
+{
+	if (op < 0 || op >= NUM_REPLAY_OPS)
+		return EVENT_NONE;
+	return replay_apply(game, op);
+}
+
+WORKER_EXPORT int worker_game_score(const TETRIS_GAME *game)
+{
+	return game->score;
+}
+
+WORKER_EXPORT const char *worker_game_board(const TETRIS_GAME *game)
+{
+	return game->board;
+}
+
+// PLANNING FUNCTIONS
+static void load_weights(BOT_WEIGHTS *weights, const float *w)
+{
+	if (w)
+		memcpy(weights->w, w, sizeof(weights->w));
+	else
+		*weights = bot_default_weights;
+}
+
+WORKER_EXPORT int worker_plan(const TETRIS_GAME *game, const float *weights)
+{
+	if (!thread_count)
+		return -1;
+	for (int i = 0; i < WORKER_JOBS; i++) {
+		if (atomic_load(&jobs[i].state) != JOB_FREE)
+			continue;
+		jobs[i].game = *game;
+		load_weights(&jobs[i].weights, weights);
+		atomic_store(&jobs[i].state, JOB_QUEUED);
+		sem_post(&queued);
+		return i;
+	}
+	return -1;
+}
+
+WORKER_EXPORT int worker_poll(int job, uint8_t *ops)
+{
+	if (job < 0 || job >= WORKER_JOBS || atomic_load(&jobs[job].state) != JOB_DONE)
+		return -1;
+	int count = jobs[job].count;
+	memcpy(ops, jobs[job].ops, count);
+	atomic_store(&jobs[job].state, JOB_FREE);
+	return count;
+}
+
+WORKER_EXPORT int worker_plan_now(const TETRIS_GAME *game, const float *weights, uint8_t *ops)
+{
+	BOT_WEIGHTS w;
+	load_weights(&w, weights);
+	return bot_plan(game, &w, ops);
+}
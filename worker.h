@@ -0,0 +1,44 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "engine.h"
+#include "bot.h"
+
+// WORKER SETTINGS
+// Plans that can be waited on at once
+#define WORKER_JOBS 64
+#define WORKER_MAX_THREADS 16
+
+// The rules and the bot for a page that draws its own board, exported from
+// the headless wasm build. Placement searches run on a pool of threads so
+// the page's frames never wait on them: worker_plan and worker_poll only
+// copy a game in and a plan out. Every call but the searches themselves is
+// meant to come from the one thread, the page's.
+
+// Starts the search threads, returns how many are running.
+int worker_start(int count);
+void worker_stop(void);
+
+// NULL if out of memory or the size is not valid.
+TETRIS_GAME *worker_game_new(int width, int height, uint32_t seed);
+void worker_game_free(TETRIS_GAME *game);
+// Takes a REPLAY_OP and returns its TETRIS_EVENT flags.
+int worker_game_apply(TETRIS_GAME *game, int op);
+int worker_game_score(const TETRIS_GAME *game);
+// Width times height cells of the settled board, '.' for empty.
+const char *worker_game_board(const TETRIS_GAME *game);
+
+// Queues a search for the piece in play, weights are NUM_BOT_FEATURES
+// floats or NULL for the default ones. Returns the job to poll, or -1 if
+// WORKER_JOBS are already queued.
+int worker_plan(const TETRIS_GAME *game, const float *weights);
+// -1 while the job runs. Then writes up to BOT_MAX_OPS inputs to ops,
+// returns how many and frees the job.
+int worker_poll(int job, uint8_t *ops);
+// The same search on the calling thread, to compare against.
+int worker_plan_now(const TETRIS_GAME *game, const float *weights, uint8_t *ops);
+
+#endif